@@ -9,10 +9,12 @@
  * - Inodes para metadados de arquivos/diretórios  
  * - Blocos de dados de tamanho fixo
  * - Bitmaps para gerenciamento de recursos livres/ocupados
- * - Ponteiros diretos
+ * - Ponteiros diretos e indiretos (simples, duplo e triplo) ou extents
+ * - Dados de arquivos pequenos guardados no próprio inode
+ * - Caudas de arquivos empacotadas em blocos compartilhados
  * - Diretórios estruturados
  * 
- * Compilação: gcc -Wall -Wextra -g sfs_persistente.c -o sfs_persistente
+ * Compilação: gcc -Wall -Wextra -g sfs_persistente.c -o sfs_persistente -pthread
  * Execução: ./sfs_persistente
  */
 
@@ -20,8 +22,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // === CONSTANTES FUNDAMENTAIS ===
 #define TAMANHO_BLOCO 512           // Tamanho de cada bloco (512 bytes)
@@ -30,6 +43,48 @@
 #define MAX_NOME_ARQUIVO 64         // Tamanho máximo do nome
 #define NUM_PONTEIROS_DIRETOS 10    // Ponteiros diretos por inode. Ponteiros diretos são usados para acessar blocos de dados diretamente, sem necessidade de indireção. Então cada inode pode apontar diretamente para até 10 blocos de dados. Com cada bloco tendo 512 bytes, isso permite que cada arquivo tenha até 5.120 bytes de dados diretamente acessíveis sem precisar de blocos indiretos. 
 #define MAGIC_NUMBER 0xED123456     // Número mágico do sistema
+#define VERSAO_SFS 9                // Versão do formato gravado em disco
+#define BYTES_DADOS_BLOCO TAMANHO_BLOCO // Bytes úteis por bloco (blocos sem cabeçalho)
+#define PONTEIROS_POR_BLOCO (BYTES_DADOS_BLOCO / sizeof(uint32_t)) // Ponteiros num bloco indireto (128)
+#define MAX_BLOCOS_ARQUIVO (NUM_PONTEIROS_DIRETOS + PONTEIROS_POR_BLOCO + \
+                            PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO + \
+                            PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO)
+#define TAM_CACHE_INDIRETO 64       // Entradas do cache de blocos indiretos
+#define MAX_SEGMENTOS_LEITURA 64    // Segmentos por writev nas leituras sem cópia
+#define MAX_SEGMENTOS_ESCRITA 16    // Partes aceitas pelo comando appendv
+#define MAX_ARQUIVOS_ABERTOS 16     // Descritores abertos ao mesmo tempo
+#define TAM_BUFFER_ESCRITA (8 * BYTES_DADOS_BLOCO) // Buffer de escrita de cada descritor
+
+// === ALOCADORES DE BLOCOS (opção de formatação) ===
+#define ALOCADOR_BITMAP        0    // Busca linear no bitmap (primeiro encaixe)
+#define ALOCADOR_BUDDY         1    // Sistema buddy com listas por ordem
+#define BUDDY_ORDENS           12   // Ordens 0..11: sequências de 1 a 2048 blocos
+#define BUDDY_NENHUMA          0xFF // Bloco que não inicia uma área livre
+
+// === MAPEAMENTO DE BLOCOS (opção de formatação) ===
+#define MAPEAMENTO_PONTEIROS   0    // Ponteiros diretos e indiretos
+#define MAPEAMENTO_EXTENTS     1    // Sequências (lógico, físico, quantidade) em árvore B
+#define EXTENTS_NO_INODE       4    // Extents guardados no próprio inode
+#define TAMANHO_INLINE ((NUM_PONTEIROS_DIRETOS + 3) * sizeof(uint32_t)) // Bytes de dados que cabem no inode (52)
+
+// === FORMATO DOS DIRETÓRIOS (opção de formatação) ===
+#define DIRETORIOS_LINEAR      0    // Entradas em sequência, busca linear
+#define DIRETORIOS_HASH        1    // Índice de hash quando passa de um bloco
+#define DIRETORIOS_BTREE       2    // Árvore B+ ordenada por nome quando passa de um bloco
+#define BALDES_HASH_INICIAIS   4    // Baldes de um diretório recém-convertido
+#define MAX_BALDES_HASH        64   // Baldes que cabem no bloco de índice
+#define PERCENTUAL_COMPACTACAO 25   // Vagas livres (%) que fazem um diretório linear ser compactado
+
+// === FLAGS DE INODE ===
+#define INODE_INLINE           0x0001 // Dados na área de ponteiros, sem blocos
+#define INODE_CAUDA            0x0002 // Último bloco parcial numa cauda compartilhada
+#define INODE_HASH             0x0004 // Diretório com índice de hash
+#define INODE_BTREE            0x0008 // Diretório em árvore B+
+
+// === CAUDAS EMPACOTADAS ===
+#define TAMANHO_FRAGMENTO      32   // Unidade de alocação dentro de um bloco de caudas
+#define FRAGMENTOS_POR_BLOCO   (BYTES_DADOS_BLOCO / TAMANHO_FRAGMENTO) // 16, um bit cada em mapa_caudas
+#define TAMANHO_MAX_CAUDA      ((FRAGMENTOS_POR_BLOCO - 1) * TAMANHO_FRAGMENTO) // 480: uma cauda maior ocuparia o bloco todo
 
 // === TIPOS DE ARQUIVO ===
 #define TIPO_ARQUIVO_REGULAR   0x01
@@ -52,18 +107,79 @@ typedef struct {
     uint32_t bloco_dados_inicio;       // Primeiro bloco de dados
     uint32_t inode_raiz;               // Inode do diretório raiz
     time_t timestamp_criacao;          // Quando o sistema foi criado
+    uint32_t alocador;                 // Alocador de blocos escolhido na formatação
+    uint32_t mapeamento;               // Mapeamento de blocos escolhido na formatação
+    uint32_t diretorios;               // Formato dos diretórios escolhido na formatação
 } Superbloco;
 
+// Superbloco das versões 7 e 8, sem o formato dos diretórios (só para converter imagens antigas)
+typedef struct {
+    uint32_t magic;
+    uint32_t versao;
+    uint32_t total_blocos;
+    uint32_t total_inodes;
+    uint32_t tamanho_bloco;
+    uint32_t blocos_livres;
+    uint32_t inodes_livres;
+    uint32_t bloco_bitmap_inodes;
+    uint32_t bloco_bitmap_blocos;
+    uint32_t bloco_tabela_inodes;
+    uint32_t bloco_dados_inicio;
+    uint32_t inode_raiz;
+    time_t timestamp_criacao;
+    uint32_t alocador;
+    uint32_t mapeamento;
+} SuperblocoV8;
+
+// Cabeçalho de um nó da árvore de extents (no inode ou num bloco)
+typedef struct {
+    uint16_t entradas;                       // Entradas em uso no nó
+    uint16_t profundidade;                   // 0 = folha com extents; >0 = índices
+} CabecalhoExtents;
+
+// Sequência de blocos lógicos mapeada para blocos físicos contíguos
+typedef struct {
+    uint32_t logico;                         // Primeiro bloco lógico
+    uint32_t fisico;                         // Primeiro bloco físico
+    uint32_t quantidade;                     // Blocos na sequência
+} Extent;
+
+// Entrada de um nó de índice da árvore de extents
+typedef struct {
+    uint32_t logico;                         // Primeiro bloco lógico coberto pelo filho
+    uint32_t bloco;                          // Bloco onde está o nó filho
+} IndiceExtent;
+
+#define EXTENTS_POR_BLOCO ((BYTES_DADOS_BLOCO - sizeof(CabecalhoExtents)) / sizeof(Extent))      // 42
+#define INDICES_POR_BLOCO ((BYTES_DADOS_BLOCO - sizeof(CabecalhoExtents)) / sizeof(IndiceExtent)) // 63
+#define INDICES_NO_INODE  (EXTENTS_NO_INODE * sizeof(Extent) / sizeof(IndiceExtent))             // 6
+
 // Inode - Metadados de um arquivo ou diretório
 typedef struct {
     uint16_t tipo;                           // Tipo do arquivo
     uint16_t permissoes;                     // Permissões (rwx)
-    uint32_t tamanho;                        // Tamanho em bytes
+    uint16_t flags;                          // INODE_INLINE, INODE_CAUDA
+    uint64_t tamanho;                        // Tamanho em bytes
     uint32_t blocos_alocados;                // Número de blocos alocados
     time_t timestamp_criacao;                // Data de criação
     time_t timestamp_modificacao;            // Última modificação
     time_t timestamp_acesso;                 // Último acesso
-    uint32_t ponteiros_diretos[NUM_PONTEIROS_DIRETOS];    // Ponteiros diretos
+    union {
+        struct {                                          // MAPEAMENTO_PONTEIROS
+            uint32_t ponteiros_diretos[NUM_PONTEIROS_DIRETOS];    // Ponteiros diretos
+            uint32_t ponteiro_indireto_simples;  // Bloco com ponteiros para blocos de dados
+            uint32_t ponteiro_indireto_duplo;    // Bloco com ponteiros para blocos indiretos simples
+            uint32_t ponteiro_indireto_triplo;   // Bloco com ponteiros para blocos indiretos duplos
+        };
+        struct {                                          // MAPEAMENTO_EXTENTS
+            CabecalhoExtents cabecalho_extents;  // Raiz da árvore de extents
+            Extent extents[EXTENTS_NO_INODE];    // Extents (ou índices) da raiz
+        };
+        char dados_inline[TAMANHO_INLINE];                // INODE_INLINE: o próprio conteúdo
+    };
+    uint32_t cauda_bloco;                    // INODE_CAUDA: bloco compartilhado com a cauda
+    uint16_t cauda_deslocamento;             // Posição da cauda dentro do bloco
+    uint16_t cauda_tamanho;                  // Bytes da cauda (o resto do tamanho)
 } Inode;
 
 // Entrada de diretório
@@ -74,12 +190,61 @@ typedef struct {
     char nome[MAX_NOME_ARQUIVO];             // Nome do arquivo
 } EntradaDiretorio;
 
-// Bloco de dados genérico
+// Diretório com hash (INODE_HASH): o bloco lógico 0 guarda o índice e cada
+// balde é uma lista de blocos com as entradas cujo nome cai nele. Buscar um
+// nome lê só o índice e os blocos do seu balde.
+typedef struct {
+    uint32_t baldes;                         // Quantidade de baldes (potência de 2)
+    uint32_t entradas;                       // Entradas ocupadas no diretório
+    uint32_t primeiro_bloco[MAX_BALDES_HASH]; // Primeiro bloco lógico de cada balde (0 = vazio)
+} IndiceHash;
+
+#define ENTRADAS_POR_BALDE ((BYTES_DADOS_BLOCO - 2 * sizeof(uint32_t)) / sizeof(EntradaDiretorio)) // 7
+
+// Bloco de um balde. Vagas livres têm inode_num = 0.
+typedef struct {
+    uint32_t proximo;                        // Próximo bloco lógico do balde (0 = último)
+    uint32_t usadas;                         // Vagas ocupadas neste bloco
+    EntradaDiretorio entradas[ENTRADAS_POR_BALDE]; // Entradas
+} BlocoBalde;
+
+// Diretório em árvore B+ (INODE_BTREE): o bloco lógico 0 guarda o cabeçalho
+// e os demais são nós. As folhas têm as entradas em ordem de nome e são
+// ligadas em sequência; nos nós internos, chaves[i] é o menor nome que pode
+// estar em filhos[i + 1]. Nós que saem da árvore viram buracos e ficam em
+// nos_livres para os próximos.
+#define NOS_LIVRES_ARVORE ((BYTES_DADOS_BLOCO - 4 * sizeof(uint32_t)) / sizeof(uint32_t)) // 124
+
+typedef struct {
+    uint32_t raiz;                           // Bloco lógico do nó raiz
+    uint32_t altura;                         // Níveis da árvore (1 = a raiz é folha)
+    uint32_t entradas;                       // Entradas no diretório
+    uint32_t livres;                         // Blocos lógicos guardados em nos_livres
+    uint32_t nos_livres[NOS_LIVRES_ARVORE];  // Blocos lógicos de nós devolvidos
+} CabecalhoArvoreDir;
+
+#define ENTRADAS_POR_FOLHA ((BYTES_DADOS_BLOCO - 3 * sizeof(uint32_t)) / sizeof(EntradaDiretorio)) // 6
+#define CHAVES_POR_NO ((BYTES_DADOS_BLOCO - 3 * sizeof(uint32_t)) / (MAX_NOME_ARQUIVO + sizeof(uint32_t))) // 7
+
+typedef struct {
+    uint32_t folha;                          // 1 nas folhas
+    uint32_t quantidade;                     // Entradas ocupadas
+    uint32_t proxima;                        // Próxima folha em ordem (0 = última)
+    EntradaDiretorio entradas[ENTRADAS_POR_FOLHA]; // Entradas ordenadas por nome
+} FolhaDiretorio;
+
+typedef struct {
+    uint32_t folha;                          // 0 nos nós internos
+    uint32_t quantidade;                     // Chaves ocupadas
+    uint32_t filhos[CHAVES_POR_NO + 1];      // Blocos lógicos dos filhos
+    char chaves[CHAVES_POR_NO][MAX_NOME_ARQUIVO]; // Separadores entre os filhos
+} NoInternoDiretorio;
+
+// Bloco de dados genérico. Não há cabeçalho: o número do bloco é o índice
+// em fs.blocos, a ocupação está no bitmap e o prefixo válido em
+// fs.bytes_validos, então toda a carga útil fica alinhada em TAMANHO_BLOCO.
 typedef struct {
-    uint32_t numero;                         // Número do bloco
-    bool em_uso;                             // Se está em uso
-    uint32_t bytes_usados;                   // Bytes utilizados
-    char dados[TAMANHO_BLOCO - 12];          // Dados (descontando metadados)
+    char dados[BYTES_DADOS_BLOCO];           // Dados
 } Bloco;
 
 // Estrutura principal do sistema
@@ -89,27 +254,203 @@ typedef struct {
     bool bitmap_blocos[TOTAL_BLOCOS];        // Bitmap de blocos
     Inode tabela_inodes[TOTAL_INODES];       // Tabela de inodes
     Bloco blocos[TOTAL_BLOCOS];              // Todos os blocos
+    uint16_t bytes_validos[TOTAL_BLOCOS];    // Prefixo escrito de cada bloco; o resto é lido como zeros
+    uint8_t buddy_ordem[TOTAL_BLOCOS];       // Ordem da área livre que começa no bloco
+    uint32_t buddy_proximo[TOTAL_BLOCOS];    // Próxima área livre da mesma ordem
+    uint32_t buddy_anterior[TOTAL_BLOCOS];   // Área livre anterior da mesma ordem
+    uint32_t buddy_listas[BUDDY_ORDENS];     // Primeira área livre de cada ordem (0 = vazia)
+    uint16_t mapa_caudas[TOTAL_BLOCOS];      // Fragmentos ocupados por caudas em cada bloco
     uint32_t diretorio_atual;                // Inode do diretório atual
     bool sistema_montado;                    // Se o sistema está montado
     char caminho_atual[256];                 // Caminho atual
 } SistemaArquivos;
 
+// Opções escolhidas no comando format
+typedef struct {
+    uint32_t alocador;                       // ALOCADOR_BITMAP ou ALOCADOR_BUDDY
+    uint32_t mapeamento;                     // MAPEAMENTO_PONTEIROS ou MAPEAMENTO_EXTENTS
+    uint32_t diretorios;                     // DIRETORIOS_HASH, DIRETORIOS_BTREE ou DIRETORIOS_LINEAR
+} OpcoesFormatacao;
+
+// Relocação de um arquivo para uma sequência contígua de blocos
+typedef struct {
+    bool ativo;                              // Se há uma relocação em andamento
+    uint32_t inode_num;                      // Inode sendo desfragmentado
+    uint32_t destino;                        // Primeiro bloco da sequência reservada
+    uint32_t quantidade;                     // Blocos lógicos cobertos pela sequência
+    uint32_t proximo;                        // Próximo bloco lógico a mover
+    uint32_t fragmentos_antes;               // Fragmentos no início da relocação
+    bool *reservado;                         // Blocos de destino ainda não usados
+} PlanoDesfragmentacao;
+
+// Estado do desfragmentador em segundo plano
+typedef struct {
+    bool thread_criada;                      // Se a thread de trabalho já existe
+    bool ativo;                              // Se deve continuar desfragmentando
+    uint32_t taxa;                           // Orçamento de blocos movidos por segundo
+    uint32_t cursor;                         // Próximo inode a examinar
+    PlanoDesfragmentacao plano;              // Relocação em andamento
+} DesfragmentadorSegundoPlano;
+
+// Arquivo aberto pelo comando open. As escritas se acumulam no buffer e
+// chegam aos blocos em blocos inteiros; como no O_APPEND, cada uma vai para o
+// fim do arquivo.
+typedef struct {
+    bool em_uso;                             // Se o descritor está aberto
+    uint32_t inode_num;                      // Arquivo aberto
+    uint64_t deslocamento;                   // Posição no arquivo do primeiro byte do buffer
+    uint32_t pendentes;                      // Bytes no buffer ainda não escritos
+    char buffer[TAM_BUFFER_ESCRITA];         // Escritas ainda não descarregadas
+} ArquivoAberto;
+
+// Entrada do cache de blocos indiretos: o bloco de ponteiros que mapeia um
+// grupo de PONTEIROS_POR_BLOCO blocos lógicos de um inode
+typedef struct {
+    uint32_t inode_num;                      // Dono da entrada (0 = vazia)
+    uint32_t grupo;                          // (indice - NUM_PONTEIROS_DIRETOS) / PONTEIROS_POR_BLOCO
+    uint32_t bloco;                          // Bloco de ponteiros do último nível
+} EntradaCacheIndireto;
+
+// Estatísticas de alocação mantidas incrementalmente (não vão para o disco;
+// são reconstruídas ao formatar ou montar)
+#define FAIXAS_HISTOGRAMA 12        // Faixas em potências de 2: 1, 2-3, 4-7, ..., 2048+
+
+typedef struct {
+    uint32_t extensao_livre[TOTAL_BLOCOS];        // Tamanho da área livre, anotado no seu primeiro e último bloco
+    uint64_t inicio_area[TOTAL_BLOCOS / 64];      // Bit ligado no primeiro bloco de cada área livre
+    uint32_t areas_por_tamanho[TOTAL_BLOCOS + 1]; // Quantidade de áreas livres de cada tamanho
+    uint32_t areas_por_faixa[FAIXAS_HISTOGRAMA];  // As mesmas áreas agrupadas por faixa
+    uint32_t total_areas;                         // Total de áreas livres
+    uint32_t areas_buddy[BUDDY_ORDENS];           // Áreas nas listas do buddy, por ordem
+    uint32_t fragmentos_inode[TOTAL_INODES];      // Sequências contíguas de cada inode
+    uint32_t total_fragmentos;                    // Soma dos fragmentos de todos os inodes
+    uint32_t inodes_com_dados;                    // Inodes com pelo menos um bloco
+    uint32_t arquivos_inline;                     // Inodes com INODE_INLINE
+    uint32_t caudas;                              // Inodes com INODE_CAUDA
+    uint32_t blocos_caudas;                       // Blocos com algum fragmento em mapa_caudas
+    uint64_t varredura_inodes[FAIXAS_HISTOGRAMA]; // Posições examinadas por alocar_inode
+    uint64_t varredura_blocos[FAIXAS_HISTOGRAMA]; // Posições examinadas pelos alocadores de blocos
+} EstatisticasAlocacao;
+
 // === VARIÁVEIS GLOBAIS ===
 static SistemaArquivos fs;
+static EstatisticasAlocacao estat;
+static EntradaCacheIndireto cache_indireto[TAM_CACHE_INDIRETO];
+
+// Protege 'fs' entre o interpretador de comandos e a thread de segundo plano
+static pthread_mutex_t trava_fs = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sinal_segundo_plano = PTHREAD_COND_INITIALIZER;
+static DesfragmentadorSegundoPlano desfrag_bg;
+
+// Leituras sem cópia em andamento por inode (não vão para o disco). Enquanto
+// houver alguma, os segmentos devolvidos apontam para fs.blocos e o inode não
+// pode ser alterado, excluído nem desfragmentado.
+static uint16_t fixacoes_inode[TOTAL_INODES];
+
+// Bloco só de zeros para os trechos não escritos de uma leitura sem cópia
+static const char bloco_zerado[BYTES_DADOS_BLOCO];
+
+// Descritores do comando open e se há escritas deles ainda não salvas no disco
+static ArquivoAberto arquivos_abertos[MAX_ARQUIVOS_ABERTOS];
+static bool escritas_nao_salvas;
+
+// Diretórios lineares esperando a compactação pela thread de segundo plano
+// (não vai para o disco; a próxima remoção volta a medir as vagas livres)
+static bool compactacao_pendente[TOTAL_INODES];
 
 // === DECLARAÇÕES DE FUNÇÕES ===
 time_t obter_timestamp();
 void timestamp_para_string(time_t timestamp, char *buffer, size_t tamanho);
+void reconstruir_estatisticas();
+void estat_bloco_ocupado(uint32_t bloco_num);
+void estat_bloco_liberado(uint32_t bloco_num);
+void estat_registrar_varredura(uint64_t *histograma, uint32_t posicoes);
 uint32_t alocar_inode();
 void liberar_inode(uint32_t inode_num);
 uint32_t alocar_bloco();
+uint32_t alocar_blocos_contiguos(uint32_t quantidade);
 void liberar_bloco(uint32_t bloco_num);
-int ler_dados_inode(uint32_t inode_num, char *buffer, uint32_t tamanho);
-int escrever_dados_inode(uint32_t inode_num, const char *dados, uint32_t tamanho);
+void buddy_inicializar();
+uint32_t buddy_alocar(uint32_t ordem);
+void buddy_liberar(uint32_t bloco_num);
+void limpar_cache_indireto();
+void invalidar_cache_indireto(uint32_t inode_num);
+uint32_t alocar_bloco_metadados();
+bool usa_extents();
+uint64_t tamanho_max_arquivo();
+uint32_t obter_bloco_inode(uint32_t inode_num, uint32_t indice);
+uint32_t obter_sequencia_inode(uint32_t inode_num, uint32_t indice, uint32_t maximo, uint32_t *quantidade);
+int definir_bloco_inode(uint32_t inode_num, uint32_t indice, uint32_t bloco_num);
+void liberar_blocos_inode(uint32_t inode_num, uint32_t a_partir_de);
+uint32_t blocos_logicos_inode(uint32_t inode_num);
+uint32_t contar_fragmentos_inode(uint32_t inode_num);
+uint32_t contar_trechos_inode(uint32_t inode_num);
+void copiar_de_bloco(uint32_t bloco_num, uint32_t inicio, char *destino, uint32_t tamanho);
+bool inode_com_cauda(uint32_t inode_num);
+void liberar_cauda(uint32_t inode_num);
+int desempacotar_cauda(uint32_t inode_num);
+bool inode_inline(uint32_t inode_num);
+int converter_inline_para_blocos(uint32_t inode_num);
+int64_t ler_dados_inode_em(uint32_t inode_num, uint64_t deslocamento, char *buffer, uint64_t tamanho);
+int64_t ler_dados_inode(uint32_t inode_num, char *buffer, uint64_t tamanho);
+bool inode_fixado(uint32_t inode_num);
+int mapear_dados_inode(uint32_t inode_num, uint64_t deslocamento, uint64_t tamanho,
+                       struct iovec *segmentos, int max_segmentos, uint64_t *bytes_mapeados);
+void liberar_mapeamento_inode(uint32_t inode_num);
+int64_t enviar_dados_inode(int fd, uint32_t inode_num, uint64_t deslocamento, uint64_t tamanho);
+int64_t escrever_vetor_inode_em(uint32_t inode_num, uint64_t deslocamento,
+                                const struct iovec *segmentos, int quantidade);
+int64_t escrever_dados_inode_em(uint32_t inode_num, uint64_t deslocamento, const char *dados, uint64_t tamanho);
+int64_t anexar_vetor_inode(uint32_t inode_num, const struct iovec *segmentos, int quantidade);
+int64_t anexar_dados_inode(uint32_t inode_num, const char *dados, uint64_t tamanho);
+char *ler_conteudo_inode(uint32_t inode_num, uint32_t folga, int64_t *bytes_lidos);
+bool dados_zerados(const char *dados, uint32_t tamanho);
+bool inode_aberto(uint32_t inode_num);
+int descarregar_arquivo_aberto(ArquivoAberto *aberto, bool tudo);
+void descarregar_arquivos_abertos();
+void fechar_arquivos_abertos();
+int64_t escrever_dados_inode(uint32_t inode_num, const char *dados, uint64_t tamanho);
+int prealocar_dados_inode(uint32_t inode_num, uint64_t tamanho);
+int truncar_dados_inode(uint32_t inode_num, uint64_t tamanho);
+uint32_t hash_nome(const char *nome);
+bool diretorio_hash(uint32_t inode_dir);
+int ler_bloco_diretorio(uint32_t inode_dir, uint32_t bloco, void *destino, uint32_t tamanho);
+int gravar_bloco_diretorio(uint32_t inode_dir, uint32_t bloco, const void *origem, uint32_t tamanho);
+uint32_t novo_bloco_diretorio(uint32_t inode_dir);
+EntradaDiretorio *listar_entradas_diretorio(uint32_t inode_dir, uint32_t *quantidade);
+uint32_t contar_entradas_diretorio(uint32_t inode_dir);
+int construir_diretorio_hash(uint32_t inode_dir, const EntradaDiretorio *entradas, uint32_t quantidade);
+uint32_t buscar_entrada_hash(uint32_t inode_dir, const char *nome);
+int adicionar_entrada_hash(uint32_t inode_dir, const EntradaDiretorio *nova);
+int remover_entrada_hash(uint32_t inode_dir, const char *nome);
+bool diretorio_arvore(uint32_t inode_dir);
+int comparar_entradas(const void *a, const void *b);
+uint32_t descer_arvore_diretorio(uint32_t inode_dir, const CabecalhoArvoreDir *cabecalho, const char *nome);
+EntradaDiretorio *listar_faixa_diretorio(uint32_t inode_dir, const char *depois_de, uint32_t maximo, uint32_t *quantidade);
+int construir_diretorio_arvore(uint32_t inode_dir, EntradaDiretorio *entradas, uint32_t quantidade);
+uint32_t buscar_entrada_arvore(uint32_t inode_dir, const char *nome);
+uint32_t novo_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho);
+void liberar_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco);
+int inserir_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco,
+                      const EntradaDiretorio *nova, char *chave_promovida, uint32_t *bloco_promovido);
+int adicionar_entrada_arvore(uint32_t inode_dir, const EntradaDiretorio *nova);
+uint32_t folha_anterior_arvore(uint32_t inode_dir, const CabecalhoArvoreDir *cabecalho, const char *nome);
+int remover_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco,
+                      const char *nome, bool *vazio);
+int remover_entrada_arvore(uint32_t inode_dir, const char *nome);
 uint32_t buscar_entrada_diretorio(uint32_t inode_dir, const char *nome);
 int adicionar_entrada_diretorio(uint32_t inode_dir, const char *nome, uint32_t inode_filho, uint8_t tipo);
 int remover_entrada_diretorio(uint32_t inode_dir, const char *nome);
+int compactar_diretorio(uint32_t inode_dir);
+bool iniciar_desfragmentacao(PlanoDesfragmentacao *plano, uint32_t inode_num);
+uint32_t avancar_desfragmentacao(PlanoDesfragmentacao *plano, uint32_t orcamento);
+void encerrar_desfragmentacao(PlanoDesfragmentacao *plano);
+void descartar_desfragmentacao_segundo_plano();
 int salvar_sistema_disco();
+void converter_superbloco_v8(const SuperblocoV8 *antigo);
+int converter_sistema_v1(FILE *arquivo);
+int converter_sistema_v7(FILE *arquivo);
+int converter_sistema_v8(FILE *arquivo);
 int carregar_sistema_disco();
 void montar_sistema();
 
@@ -126,6 +467,167 @@ void timestamp_para_string(time_t timestamp, char *buffer, size_t tamanho) {
     strftime(buffer, tamanho, "%d/%m/%Y %H:%M:%S", tm_info);
 }
 
+// === ESTATÍSTICAS DE ALOCAÇÃO ===
+// Cada área livre de blocos tem seu tamanho anotado no primeiro e no último
+// bloco (como as etiquetas de fronteira de um alocador de memória), e o seu
+// primeiro bloco fica marcado em inicio_area. Ao ocupar ou liberar um bloco só
+// as áreas vizinhas mudam, e os histogramas são atualizados na hora, então
+// 'stat' não precisa varrer o bitmap.
+
+// Faixa do histograma de um valor: 1 -> 0, 2-3 -> 1, 4-7 -> 2, ...
+uint32_t faixa_histograma(uint32_t valor) {
+    uint32_t faixa = 0;
+    while (valor > 1 && faixa + 1 < FAIXAS_HISTOGRAMA) {
+        valor >>= 1;
+        faixa++;
+    }
+    return faixa;
+}
+
+// Anota uma área livre [inicio, inicio + tamanho)
+void estat_adicionar_area(uint32_t inicio, uint32_t tamanho) {
+    estat.inicio_area[inicio / 64] |= 1ULL << (inicio % 64);
+    estat.extensao_livre[inicio] = tamanho;
+    estat.extensao_livre[inicio + tamanho - 1] = tamanho;
+    estat.areas_por_tamanho[tamanho]++;
+    estat.areas_por_faixa[faixa_histograma(tamanho)]++;
+    estat.total_areas++;
+}
+
+// Desconta uma área livre que deixou de existir (foi dividida ou fundida)
+void estat_remover_area(uint32_t inicio, uint32_t tamanho) {
+    estat.inicio_area[inicio / 64] &= ~(1ULL << (inicio % 64));
+    estat.areas_por_tamanho[tamanho]--;
+    estat.areas_por_faixa[faixa_histograma(tamanho)]--;
+    estat.total_areas--;
+}
+
+// Tamanho da maior área livre, calculado só quando pedido: a faixa mais alta
+// com áreas diz onde procurar, e só os tamanhos dela são examinados
+uint32_t estat_maior_area() {
+    for (int f = FAIXAS_HISTOGRAMA - 1; f >= 0; f--) {
+        if (estat.areas_por_faixa[f] == 0) continue;
+        
+        uint32_t minimo = 1u << f;
+        uint32_t maximo = f + 1 == FAIXAS_HISTOGRAMA ? TOTAL_BLOCOS : (2u << f) - 1;
+        for (uint32_t tamanho = maximo; tamanho >= minimo; tamanho--) {
+            if (estat.areas_por_tamanho[tamanho] > 0) return tamanho;
+        }
+    }
+    return 0;
+}
+
+// Atualiza as áreas livres depois que o bitmap marcou o bloco como ocupado
+void estat_bloco_ocupado(uint32_t bloco_num) {
+    // Início da área que continha o bloco: o último início marcado até ele,
+    // procurado 64 blocos por vez (o buddy aloca do meio das áreas grandes)
+    uint32_t palavra = bloco_num / 64;
+    uint64_t marcas = estat.inicio_area[palavra] & (~0ULL >> (63 - bloco_num % 64));
+    while (marcas == 0 && palavra > 0) marcas = estat.inicio_area[--palavra];
+    uint32_t inicio = palavra * 64 + 63 - (uint32_t)__builtin_clzll(marcas);
+    
+    uint32_t tamanho = estat.extensao_livre[inicio];
+    uint32_t fim = inicio + tamanho - 1;
+    
+    estat_remover_area(inicio, tamanho);
+    if (bloco_num > inicio) estat_adicionar_area(inicio, bloco_num - inicio);
+    if (bloco_num < fim) estat_adicionar_area(bloco_num + 1, fim - bloco_num);
+}
+
+// Atualiza as áreas livres depois que o bitmap marcou o bloco como livre
+void estat_bloco_liberado(uint32_t bloco_num) {
+    uint32_t esquerda = 0, direita = 0;
+    
+    if (bloco_num > 0 && !fs.bitmap_blocos[bloco_num - 1]) {
+        esquerda = estat.extensao_livre[bloco_num - 1];
+        estat_remover_area(bloco_num - esquerda, esquerda);
+    }
+    if (bloco_num + 1 < TOTAL_BLOCOS && !fs.bitmap_blocos[bloco_num + 1]) {
+        direita = estat.extensao_livre[bloco_num + 1];
+        estat_remover_area(bloco_num + 1, direita);
+    }
+    estat_adicionar_area(bloco_num - esquerda, esquerda + 1 + direita);
+}
+
+// Registra quantas posições um alocador examinou até encontrar um recurso
+void estat_registrar_varredura(uint64_t *histograma, uint32_t posicoes) {
+    histograma[faixa_histograma(posicoes)]++;
+}
+
+// Ajusta os fragmentos de um inode (e os totais do sistema)
+void estat_ajustar_fragmentos(uint32_t inode_num, int delta) {
+    if (delta == 0) return;
+    
+    uint32_t antes = estat.fragmentos_inode[inode_num];
+    uint32_t depois = antes + delta;
+    
+    estat.fragmentos_inode[inode_num] = depois;
+    estat.total_fragmentos += delta;
+    if (antes == 0 && depois > 0) estat.inodes_com_dados++;
+    if (antes > 0 && depois == 0) estat.inodes_com_dados--;
+}
+
+// Liga ou desliga INODE_INLINE ou INODE_CAUDA, contando a mudança
+void definir_flag_inode(uint32_t inode_num, uint16_t flag, bool ligada) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (((inode->flags & flag) != 0) == ligada) return;
+    
+    uint32_t *contador = flag == INODE_INLINE ? &estat.arquivos_inline : &estat.caudas;
+    if (ligada) {
+        inode->flags |= flag;
+        (*contador)++;
+    } else {
+        inode->flags &= ~flag;
+        (*contador)--;
+    }
+}
+
+// Refaz todas as estatísticas a partir do bitmap e da tabela de inodes
+void reconstruir_estatisticas() {
+    memset(&estat, 0, sizeof(estat));
+    
+    uint32_t inicio = 0;
+    for (uint32_t i = 0; i <= TOTAL_BLOCOS; i++) {
+        bool livre = i < TOTAL_BLOCOS && !fs.bitmap_blocos[i];
+        if (livre && (i == 0 || fs.bitmap_blocos[i - 1])) inicio = i;
+        if (!livre && i > 0 && !fs.bitmap_blocos[i - 1]) estat_adicionar_area(inicio, i - inicio);
+    }
+    
+    if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+        for (uint32_t ordem = 0; ordem < BUDDY_ORDENS; ordem++) {
+            for (uint32_t b = fs.buddy_listas[ordem]; b != 0; b = fs.buddy_proximo[b]) {
+                estat.areas_buddy[ordem]++;
+            }
+        }
+    }
+    
+    for (uint32_t i = 1; i < TOTAL_INODES; i++) {
+        if (fs.bitmap_inodes[i]) {
+            estat_ajustar_fragmentos(i, (int)contar_fragmentos_inode(i));
+            if (fs.tabela_inodes[i].flags & INODE_INLINE) estat.arquivos_inline++;
+            if (fs.tabela_inodes[i].flags & INODE_CAUDA) estat.caudas++;
+        }
+    }
+    for (uint32_t i = 0; i < TOTAL_BLOCOS; i++) {
+        if (fs.mapa_caudas[i] != 0) estat.blocos_caudas++;
+    }
+}
+
+// Percentil aproximado de um histograma por faixas: limite superior da
+// faixa onde a contagem acumulada alcança 'percentual'
+uint32_t percentil_histograma(const uint64_t *histograma, uint32_t percentual) {
+    uint64_t total = 0;
+    for (uint32_t f = 0; f < FAIXAS_HISTOGRAMA; f++) total += histograma[f];
+    if (total == 0) return 0;
+    
+    uint64_t acumulado = 0;
+    for (uint32_t f = 0; f < FAIXAS_HISTOGRAMA; f++) {
+        acumulado += histograma[f];
+        if (acumulado * 100 >= total * percentual) return (2u << f) - 1;
+    }
+    return (2u << (FAIXAS_HISTOGRAMA - 1)) - 1;
+}
+
 // === GERENCIAMENTO DE RECURSOS ===
 
 // Aloca um inode livre
@@ -141,10 +643,12 @@ uint32_t alocar_inode() {
             fs.tabela_inodes[i].timestamp_modificacao = obter_timestamp();
             fs.tabela_inodes[i].timestamp_acesso = obter_timestamp();
             
+            estat_registrar_varredura(estat.varredura_inodes, i);
             printf("[DEBUG] Inode %u alocado\n", i);
             return i;
         }
     }
+    estat_registrar_varredura(estat.varredura_inodes, TOTAL_INODES - 1);
     return 0; // Sem inodes livres
 }
 
@@ -153,29 +657,181 @@ void liberar_inode(uint32_t inode_num) {
     if (inode_num > 0 && inode_num < TOTAL_INODES && fs.bitmap_inodes[inode_num]) {
         fs.bitmap_inodes[inode_num] = false;
         fs.superbloco.inodes_livres++;
+        definir_flag_inode(inode_num, INODE_INLINE, false);
+        definir_flag_inode(inode_num, INODE_CAUDA, false);
         memset(&fs.tabela_inodes[inode_num], 0, sizeof(Inode));
         printf("[DEBUG] Inode %u liberado\n", inode_num);
     }
 }
 
+// === ALOCADOR BUDDY ===
+// Opera sobre a região de dados [bloco_dados_inicio, TOTAL_BLOCOS). Cada área
+// livre tem 2^ordem blocos, alinhada a esse tamanho relativo ao início da
+// região, e fica numa lista duplamente encadeada da sua ordem. O bitmap
+// continua sendo a fonte de verdade sobre quais blocos estão em uso.
+
+// Coloca uma área livre na lista da sua ordem
+void buddy_inserir(uint32_t bloco_num, uint32_t ordem) {
+    uint32_t primeiro = fs.buddy_listas[ordem];
+    
+    fs.buddy_ordem[bloco_num] = ordem;
+    fs.buddy_anterior[bloco_num] = 0;
+    fs.buddy_proximo[bloco_num] = primeiro;
+    if (primeiro != 0) fs.buddy_anterior[primeiro] = bloco_num;
+    fs.buddy_listas[ordem] = bloco_num;
+    estat.areas_buddy[ordem]++;
+}
+
+// Retira uma área livre da lista da sua ordem
+void buddy_remover(uint32_t bloco_num) {
+    uint32_t ordem = fs.buddy_ordem[bloco_num];
+    uint32_t anterior = fs.buddy_anterior[bloco_num];
+    uint32_t proximo = fs.buddy_proximo[bloco_num];
+    
+    if (anterior != 0) fs.buddy_proximo[anterior] = proximo;
+    else fs.buddy_listas[ordem] = proximo;
+    if (proximo != 0) fs.buddy_anterior[proximo] = anterior;
+    
+    fs.buddy_ordem[bloco_num] = BUDDY_NENHUMA;
+    estat.areas_buddy[ordem]--;
+}
+
+// Divide a região de dados (ainda toda livre) nas maiores áreas alinhadas possíveis
+void buddy_inicializar() {
+    uint32_t base = fs.superbloco.bloco_dados_inicio;
+    uint32_t tamanho_regiao = TOTAL_BLOCOS - base;
+    
+    memset(fs.buddy_ordem, BUDDY_NENHUMA, sizeof(fs.buddy_ordem));
+    memset(fs.buddy_listas, 0, sizeof(fs.buddy_listas));
+    
+    uint32_t relativo = 0;
+    while (relativo < tamanho_regiao) {
+        uint32_t ordem = BUDDY_ORDENS - 1;
+        while (relativo % (1u << ordem) != 0 || relativo + (1u << ordem) > tamanho_regiao) {
+            ordem--;
+        }
+        buddy_inserir(base + relativo, ordem);
+        relativo += 1u << ordem;
+    }
+}
+
+// Retira uma área de 2^ordem blocos, dividindo áreas maiores se preciso.
+// Retorna o primeiro bloco da área ou 0 se não houver espaço.
+uint32_t buddy_alocar(uint32_t ordem) {
+    uint32_t atual = ordem;
+    while (atual < BUDDY_ORDENS && fs.buddy_listas[atual] == 0) {
+        atual++;
+    }
+    estat_registrar_varredura(estat.varredura_blocos, atual - ordem + 1);
+    if (atual == BUDDY_ORDENS) return 0;
+    
+    uint32_t bloco_num = fs.buddy_listas[atual];
+    buddy_remover(bloco_num);
+    
+    // Devolve a metade superior a cada divisão
+    while (atual > ordem) {
+        atual--;
+        buddy_inserir(bloco_num + (1u << atual), atual);
+    }
+    return bloco_num;
+}
+
+// Devolve um único bloco, fundindo-o com seus buddies livres enquanto possível
+void buddy_liberar(uint32_t bloco_num) {
+    uint32_t base = fs.superbloco.bloco_dados_inicio;
+    uint32_t tamanho_regiao = TOTAL_BLOCOS - base;
+    uint32_t relativo = bloco_num - base;
+    uint32_t ordem = 0;
+    
+    while (ordem + 1 < BUDDY_ORDENS) {
+        uint32_t relativo_buddy = relativo ^ (1u << ordem);
+        if (relativo_buddy + (1u << ordem) > tamanho_regiao) break;
+        if (fs.buddy_ordem[base + relativo_buddy] != ordem) break;
+        
+        buddy_remover(base + relativo_buddy);
+        relativo &= ~(1u << ordem);
+        ordem++;
+    }
+    buddy_inserir(base + relativo, ordem);
+}
+
+// Marca um bloco como ocupado. Os dados não são zerados: bytes além de
+// bytes_validos são lidos como zeros (ver copiar_de_bloco)
+void ocupar_bloco(uint32_t bloco_num) {
+    fs.bitmap_blocos[bloco_num] = true;
+    fs.superbloco.blocos_livres--;
+    estat_bloco_ocupado(bloco_num);
+    fs.bytes_validos[bloco_num] = 0;
+}
+
 // Aloca um bloco livre
 uint32_t alocar_bloco() {
-    for (uint32_t i = fs.superbloco.bloco_dados_inicio; i < TOTAL_BLOCOS; i++) {
-        if (!fs.bitmap_blocos[i]) {
-            fs.bitmap_blocos[i] = true;
-            fs.superbloco.blocos_livres--;
-            
-            // Inicializa o bloco
-            fs.blocos[i].numero = i;
-            fs.blocos[i].em_uso = true;
-            fs.blocos[i].bytes_usados = 0;
-            memset(fs.blocos[i].dados, 0, TAMANHO_BLOCO - 12);
-            
-            printf("[DEBUG] Bloco %u alocado\n", i);
-            return i;
+    uint32_t bloco_num = 0;
+    
+    if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+        bloco_num = buddy_alocar(0);
+    } else {
+        uint32_t i;
+        for (i = fs.superbloco.bloco_dados_inicio; i < TOTAL_BLOCOS; i++) {
+            if (!fs.bitmap_blocos[i]) {
+                bloco_num = i;
+                break;
+            }
+        }
+        estat_registrar_varredura(estat.varredura_blocos, i - fs.superbloco.bloco_dados_inicio + 1);
+    }
+    
+    if (bloco_num == 0) return 0; // Sem blocos livres
+    
+    ocupar_bloco(bloco_num);
+    printf("[DEBUG] Bloco %u alocado\n", bloco_num);
+    return bloco_num;
+}
+
+// Aloca uma sequência de blocos contíguos, não escritos (bytes_validos = 0).
+// No bitmap é uma busca de primeiro encaixe; no buddy, uma área de ordem
+// suficiente cujo excesso é devolvido logo em seguida.
+// Retorna o primeiro bloco da sequência ou 0 se não houver espaço contíguo.
+uint32_t alocar_blocos_contiguos(uint32_t quantidade) {
+    if (quantidade == 0) return 0;
+    
+    uint32_t inicio = 0;
+    
+    if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+        uint32_t ordem = 0;
+        while ((1u << ordem) < quantidade) ordem++;
+        if (ordem >= BUDDY_ORDENS) return 0;
+        
+        inicio = buddy_alocar(ordem);
+        if (inicio == 0) return 0;
+        
+        for (uint32_t b = inicio + quantidade; b < inicio + (1u << ordem); b++) {
+            buddy_liberar(b);
+        }
+    } else {
+        uint32_t candidato = fs.superbloco.bloco_dados_inicio;
+        uint32_t livres_seguidos = 0;
+        
+        uint32_t i;
+        for (i = fs.superbloco.bloco_dados_inicio; i < TOTAL_BLOCOS; i++) {
+            if (fs.bitmap_blocos[i]) {
+                livres_seguidos = 0;
+                candidato = i + 1;
+            } else if (++livres_seguidos == quantidade) {
+                inicio = candidato;
+                break;
+            }
         }
+        estat_registrar_varredura(estat.varredura_blocos, i - fs.superbloco.bloco_dados_inicio + 1);
+        if (inicio == 0) return 0; // Sem espaço contíguo
     }
-    return 0; // Sem blocos livres
+    
+    for (uint32_t b = inicio; b < inicio + quantidade; b++) {
+        ocupar_bloco(b);
+    }
+    
+    printf("[DEBUG] Blocos %u-%u alocados\n", inicio, inicio + quantidade - 1);
+    return inicio;
 }
 
 // Libera um bloco
@@ -184,316 +840,2836 @@ void liberar_bloco(uint32_t bloco_num) {
         bloco_num < TOTAL_BLOCOS && fs.bitmap_blocos[bloco_num]) {
         fs.bitmap_blocos[bloco_num] = false;
         fs.superbloco.blocos_livres++;
+        estat_bloco_liberado(bloco_num);
+        
+        // O conteúdo antigo nunca é lido de novo porque o próximo dono
+        // começa com bytes_validos = 0
+        fs.bytes_validos[bloco_num] = 0;
         
-        memset(&fs.blocos[bloco_num], 0, sizeof(Bloco));
+        if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+            buddy_liberar(bloco_num);
+        }
         printf("[DEBUG] Bloco %u liberado\n", bloco_num);
     }
 }
 
-// === OPERAÇÕES COM ARQUIVOS ===
+// === MAPEAMENTO DE BLOCOS (ponteiros ou extents) ===
+// O mapeamento é escolhido na formatação. No de ponteiros, os primeiros NUM_PONTEIROS_DIRETOS blocos lógicos ficam nos ponteiros
+// diretos; os seguintes passam por blocos de ponteiros de um, dois e três
+// níveis. Para não reler a cadeia de blocos de ponteiros a cada acesso, o
+// último nível (o bloco que aponta direto para os dados) fica num cache
+// indexado por (inode, grupo de PONTEIROS_POR_BLOCO blocos lógicos).
 
-// Lê dados de um inode
-int ler_dados_inode(uint32_t inode_num, char *buffer, uint32_t tamanho) {
-    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
-        return -1;
-    }
-    
-    Inode *inode = &fs.tabela_inodes[inode_num];
-    uint32_t bytes_lidos = 0;
-    uint32_t bytes_para_ler = (tamanho < inode->tamanho) ? tamanho : inode->tamanho;
-    
-    // Lê dos ponteiros diretos
-    for (int i = 0; i < NUM_PONTEIROS_DIRETOS && bytes_lidos < bytes_para_ler; i++) {
-        if (inode->ponteiros_diretos[i] == 0) break;
-        
-        uint32_t bloco_num = inode->ponteiros_diretos[i];
-        uint32_t bytes_neste_bloco = bytes_para_ler - bytes_lidos;
-        if (bytes_neste_bloco > fs.blocos[bloco_num].bytes_usados) {
-            bytes_neste_bloco = fs.blocos[bloco_num].bytes_usados;
+// Limpa o cache de blocos indiretos (ao formatar ou montar)
+void limpar_cache_indireto() {
+    memset(cache_indireto, 0, sizeof(cache_indireto));
+}
+
+// Esquece os blocos indiretos de um inode (quando eles são liberados)
+void invalidar_cache_indireto(uint32_t inode_num) {
+    for (int i = 0; i < TAM_CACHE_INDIRETO; i++) {
+        if (cache_indireto[i].inode_num == inode_num) {
+            cache_indireto[i].inode_num = 0;
         }
-        
-        memcpy(buffer + bytes_lidos, fs.blocos[bloco_num].dados, bytes_neste_bloco);
-        bytes_lidos += bytes_neste_bloco;
     }
-    
-    // Atualiza timestamp de acesso
-    inode->timestamp_acesso = obter_timestamp();
-    
-    return bytes_lidos;
 }
 
-// Escreve dados em um inode
-int escrever_dados_inode(uint32_t inode_num, const char *dados, uint32_t tamanho) {
-    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
-        return -1;
+// Ponteiros guardados num bloco indireto
+uint32_t *ponteiros_do_bloco(uint32_t bloco_num) {
+    return (uint32_t*)fs.blocos[bloco_num].dados;
+}
+
+// Aloca um bloco de metadados (ponteiros ou nó de extents). Diferente dos
+// blocos de dados, ele precisa começar zerado: cada entrada é lida
+// diretamente como "sem bloco"
+uint32_t alocar_bloco_metadados() {
+    uint32_t bloco_num = alocar_bloco();
+    if (bloco_num != 0) {
+        memset(fs.blocos[bloco_num].dados, 0, BYTES_DADOS_BLOCO);
+        fs.bytes_validos[bloco_num] = BYTES_DADOS_BLOCO;
     }
-    
+    return bloco_num;
+}
+
+// Localiza a posição que guarda o ponteiro do bloco lógico 'indice'. Com
+// 'criar', aloca os blocos de ponteiros que faltarem no caminho. Retorna
+// NULL se o caminho não existir (ou não puder ser criado).
+uint32_t *localizar_ponteiro(uint32_t inode_num, uint32_t indice, bool criar) {
     Inode *inode = &fs.tabela_inodes[inode_num];
     
-    // Libera blocos antigos
-    for (int i = 0; i < NUM_PONTEIROS_DIRETOS; i++) {
-        if (inode->ponteiros_diretos[i] != 0) {
-            liberar_bloco(inode->ponteiros_diretos[i]);
-            inode->ponteiros_diretos[i] = 0;
-        }
+    if (indice < NUM_PONTEIROS_DIRETOS) {
+        return &inode->ponteiros_diretos[indice];
     }
     
-    // Calcula blocos necessários
-    uint32_t blocos_necessarios = (tamanho + (TAMANHO_BLOCO - 12) - 1) / (TAMANHO_BLOCO - 12);
+    uint32_t relativo = indice - NUM_PONTEIROS_DIRETOS;
+    uint32_t grupo = relativo / PONTEIROS_POR_BLOCO;
+    uint32_t posicao = relativo % PONTEIROS_POR_BLOCO;
+    EntradaCacheIndireto *cache = &cache_indireto[(inode_num * 31 + grupo) % TAM_CACHE_INDIRETO];
     
-    if (blocos_necessarios > NUM_PONTEIROS_DIRETOS) {
-        printf("Erro: Arquivo muito grande para ponteiros diretos.\n");
-        return -1;
+    if (cache->inode_num == inode_num && cache->grupo == grupo) {
+        return &ponteiros_do_bloco(cache->bloco)[posicao];
     }
     
-    // Aloca e escreve novos blocos
-    uint32_t bytes_escritos = 0;
-    const char *ptr_dados = dados;
+    // Escolhe a árvore e os deslocamentos em cada nível
+    uint32_t *raiz;
+    uint32_t niveis;
+    uint32_t deslocamentos[3];
     
-    for (uint32_t i = 0; i < blocos_necessarios; i++) {
-        uint32_t bloco_num = alocar_bloco();
-        if (bloco_num == 0) {
-            printf("Erro: Sem blocos livres.\n");
-            return -1;
+    if (relativo < PONTEIROS_POR_BLOCO) {
+        raiz = &inode->ponteiro_indireto_simples;
+        niveis = 1;
+        deslocamentos[0] = relativo;
+    } else if ((relativo -= PONTEIROS_POR_BLOCO) < PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO) {
+        raiz = &inode->ponteiro_indireto_duplo;
+        niveis = 2;
+        deslocamentos[0] = relativo / PONTEIROS_POR_BLOCO;
+        deslocamentos[1] = relativo % PONTEIROS_POR_BLOCO;
+    } else if ((relativo -= PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO) <
+               PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO) {
+        raiz = &inode->ponteiro_indireto_triplo;
+        niveis = 3;
+        deslocamentos[0] = relativo / (PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO);
+        deslocamentos[1] = (relativo / PONTEIROS_POR_BLOCO) % PONTEIROS_POR_BLOCO;
+        deslocamentos[2] = relativo % PONTEIROS_POR_BLOCO;
+    } else {
+        return NULL; // Além do tamanho máximo de arquivo
+    }
+    
+    uint32_t *ponteiro = raiz;
+    for (uint32_t nivel = 0; nivel < niveis; nivel++) {
+        if (*ponteiro == 0) {
+            if (!criar) return NULL;
+            *ponteiro = alocar_bloco_metadados();
+            if (*ponteiro == 0) return NULL;
         }
         
-        inode->ponteiros_diretos[i] = bloco_num;
-        
-        uint32_t bytes_neste_bloco = tamanho - bytes_escritos;
-        if (bytes_neste_bloco > TAMANHO_BLOCO - 12) {
-            bytes_neste_bloco = TAMANHO_BLOCO - 12;
+        if (nivel + 1 == niveis) {
+            cache->inode_num = inode_num;
+            cache->grupo = grupo;
+            cache->bloco = *ponteiro;
         }
-        
-        memcpy(fs.blocos[bloco_num].dados, ptr_dados, bytes_neste_bloco);
-        fs.blocos[bloco_num].bytes_usados = bytes_neste_bloco;
-        
-        ptr_dados += bytes_neste_bloco;
-        bytes_escritos += bytes_neste_bloco;
+        ponteiro = &ponteiros_do_bloco(*ponteiro)[deslocamentos[nivel]];
     }
+    return ponteiro;
+}
+
+// Estado de liberar_ponteiros_inode enquanto percorre os blocos em ordem lógica
+typedef struct {
+    uint32_t inode_num;
+    uint32_t a_partir_de;                    // Primeiro bloco lógico a liberar
+    uint32_t anterior;                       // Último bloco físico visto
+    uint32_t fragmentos;                     // Fragmentos removidos
+} Liberacao;
+
+// Libera um bloco de dados visitado em ordem lógica
+void liberar_bloco_de_dados(Liberacao *lib, uint32_t *ponteiro) {
+    uint32_t bloco_num = *ponteiro;
     
-    // Atualiza metadados do inode
-    inode->tamanho = tamanho;
-    inode->blocos_alocados = blocos_necessarios;
-    inode->timestamp_modificacao = obter_timestamp();
+    if (lib->anterior == 0 || bloco_num != lib->anterior + 1) lib->fragmentos++;
+    lib->anterior = bloco_num;
     
-    return bytes_escritos;
+    liberar_bloco(bloco_num);
+    fs.tabela_inodes[lib->inode_num].blocos_alocados--;
+    *ponteiro = 0;
 }
 
-// Busca entrada em diretório
-uint32_t buscar_entrada_diretorio(uint32_t inode_dir, const char *nome) {
-    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
-        return 0;
-    }
-    
-    Inode *inode = &fs.tabela_inodes[inode_dir];
-    if (inode->tipo != TIPO_DIRETORIO) {
-        return 0;
+// Libera a subárvore de 'niveis' níveis em *ponteiro, que cobre os blocos
+// lógicos [base, base + PONTEIROS_POR_BLOCO^niveis), a partir de
+// lib->a_partir_de. O bloco de ponteiros só é liberado se ficar vazio, o que
+// num arquivo esparso pode acontecer mesmo antes de a_partir_de.
+void liberar_subarvore(Liberacao *lib, uint32_t *ponteiro, uint32_t niveis, uint32_t base) {
+    if (*ponteiro == 0) {
+        lib->anterior = 0;
+        return;
     }
     
-    // Lê conteúdo do diretório
-    char buffer[TAMANHO_BLOCO * NUM_PONTEIROS_DIRETOS];
-    int bytes_lidos = ler_dados_inode(inode_dir, buffer, sizeof(buffer));
+    uint32_t alcance_filho = 1;
+    for (uint32_t n = 1; n < niveis; n++) alcance_filho *= PONTEIROS_POR_BLOCO;
     
-    if (bytes_lidos <= 0) return 0;
-    
-    // Procura pela entrada
-    char *ptr = buffer;
-    while (ptr < buffer + bytes_lidos) {
-        EntradaDiretorio *entrada = (EntradaDiretorio*)ptr;
+    uint32_t *filhos = ponteiros_do_bloco(*ponteiro);
+    for (uint32_t k = 0; k < PONTEIROS_POR_BLOCO; k++) {
+        uint32_t base_filho = base + k * alcance_filho;
+        if (base_filho + alcance_filho <= lib->a_partir_de) continue;
         
-        if (strcmp(entrada->nome, nome) == 0) {
-            return entrada->inode_num;
+        if (niveis == 1) {
+            if (filhos[k] != 0) liberar_bloco_de_dados(lib, &filhos[k]);
+            else lib->anterior = 0;
+        } else {
+            liberar_subarvore(lib, &filhos[k], niveis - 1, base_filho);
         }
-        
-        ptr += sizeof(EntradaDiretorio);
     }
     
-    return 0; // Não encontrado
+    for (uint32_t k = 0; k < PONTEIROS_POR_BLOCO; k++) {
+        if (filhos[k] != 0) return;
+    }
+    liberar_bloco(*ponteiro);
+    *ponteiro = 0;
 }
 
-// Adiciona entrada em diretório
-int adicionar_entrada_diretorio(uint32_t inode_dir, const char *nome, uint32_t inode_filho, uint8_t tipo) {
-    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
-        return -1;
-    }
+// Libera os blocos mapeados por ponteiros a partir de 'a_partir_de',
+// inclusive os blocos de ponteiros que deixam de ser necessários
+void liberar_ponteiros_inode(uint32_t inode_num, uint32_t a_partir_de) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    Liberacao lib = { inode_num, a_partir_de, 0, 0 };
     
-    Inode *inode = &fs.tabela_inodes[inode_dir];
-    if (inode->tipo != TIPO_DIRETORIO) {
-        return -1;
-    }
+    if (a_partir_de > 0) lib.anterior = obter_bloco_inode(inode_num, a_partir_de - 1);
     
-    // Verifica se já existe
-    if (buscar_entrada_diretorio(inode_dir, nome) != 0) {
-        printf("Erro: Entrada '%s' já existe no diretório.\n", nome);
-        return -1;
+    for (uint32_t i = a_partir_de; i < NUM_PONTEIROS_DIRETOS; i++) {
+        if (inode->ponteiros_diretos[i] != 0) liberar_bloco_de_dados(&lib, &inode->ponteiros_diretos[i]);
+        else lib.anterior = 0;
     }
     
-    // Lê conteúdo atual
-    char buffer[TAMANHO_BLOCO * NUM_PONTEIROS_DIRETOS];
-    int bytes_atuais = ler_dados_inode(inode_dir, buffer, sizeof(buffer));
-    if (bytes_atuais < 0) bytes_atuais = 0;
-    
-    // Cria nova entrada
-    EntradaDiretorio nova_entrada;
-    nova_entrada.inode_num = inode_filho;
-    nova_entrada.tamanho_nome = strlen(nome);
-    nova_entrada.tipo_arquivo = tipo;
-    strncpy(nova_entrada.nome, nome, MAX_NOME_ARQUIVO - 1);
-    nova_entrada.nome[MAX_NOME_ARQUIVO - 1] = '\0';
-    
-    // Adiciona nova entrada
-    memcpy(buffer + bytes_atuais, &nova_entrada, sizeof(EntradaDiretorio));
-    bytes_atuais += sizeof(EntradaDiretorio);
+    uint32_t base = NUM_PONTEIROS_DIRETOS;
+    liberar_subarvore(&lib, &inode->ponteiro_indireto_simples, 1, base);
+    base += PONTEIROS_POR_BLOCO;
+    liberar_subarvore(&lib, &inode->ponteiro_indireto_duplo, 2, base);
+    base += PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO;
+    liberar_subarvore(&lib, &inode->ponteiro_indireto_triplo, 3, base);
     
-    // Escreve de volta
-    return escrever_dados_inode(inode_dir, buffer, bytes_atuais);
+    invalidar_cache_indireto(inode_num);
+    estat_ajustar_fragmentos(inode_num, -(int)lib.fragmentos);
 }
 
-// Remove entrada de diretório
-int remover_entrada_diretorio(uint32_t inode_dir, const char *nome) {
-    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
-        return -1;
-    }
-    
-    Inode *inode = &fs.tabela_inodes[inode_dir];
-    if (inode->tipo != TIPO_DIRETORIO) {
-        return -1;
-    }
+// Maior índice lógico mapeado de uma subárvore de ponteiros, mais um (0 se vazia)
+uint32_t fim_subarvore(uint32_t bloco_num, uint32_t niveis, uint32_t base) {
+    if (bloco_num == 0) return 0;
     
-    // Lê conteúdo do diretório
-    char buffer[TAMANHO_BLOCO * NUM_PONTEIROS_DIRETOS];
-    int bytes_lidos = ler_dados_inode(inode_dir, buffer, sizeof(buffer));
+    uint32_t alcance_filho = 1;
+    for (uint32_t n = 1; n < niveis; n++) alcance_filho *= PONTEIROS_POR_BLOCO;
     
-    if (bytes_lidos <= 0) return -1;
-    
-    // Procura pela entrada e remove
-    char *ptr = buffer;
-    bool encontrado = false;
-    
-    while (ptr < buffer + bytes_lidos) {
-        EntradaDiretorio *entrada = (EntradaDiretorio*)ptr;
-        
-        if (strcmp(entrada->nome, nome) == 0) {
-            // Remove a entrada movendo o resto do buffer
-            size_t bytes_restantes = (buffer + bytes_lidos) - (ptr + sizeof(EntradaDiretorio));
-            memmove(ptr, ptr + sizeof(EntradaDiretorio), bytes_restantes);
-            bytes_lidos -= sizeof(EntradaDiretorio);
-            encontrado = true;
-            break;
-        }
+    uint32_t *filhos = ponteiros_do_bloco(bloco_num);
+    for (uint32_t k = PONTEIROS_POR_BLOCO; k-- > 0; ) {
+        if (filhos[k] == 0) continue;
+        if (niveis == 1) return base + k + 1;
         
-        ptr += sizeof(EntradaDiretorio);
-    }
-    
-    if (!encontrado) {
-        return -1;
+        uint32_t fim = fim_subarvore(filhos[k], niveis - 1, base + k * alcance_filho);
+        if (fim != 0) return fim;
     }
-    
-    // Escreve de volta o diretório atualizado
-    return escrever_dados_inode(inode_dir, buffer, bytes_lidos);
+    return 0;
+}
+
+// Último bloco lógico mapeado por ponteiros, mais um
+uint32_t blocos_logicos_ponteiros(uint32_t inode_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    uint32_t base_duplo = NUM_PONTEIROS_DIRETOS + PONTEIROS_POR_BLOCO;
+    uint32_t base_triplo = base_duplo + PONTEIROS_POR_BLOCO * PONTEIROS_POR_BLOCO;
+    uint32_t fim;
+    
+    if ((fim = fim_subarvore(inode->ponteiro_indireto_triplo, 3, base_triplo)) != 0) return fim;
+    if ((fim = fim_subarvore(inode->ponteiro_indireto_duplo, 2, base_duplo)) != 0) return fim;
+    if ((fim = fim_subarvore(inode->ponteiro_indireto_simples, 1, NUM_PONTEIROS_DIRETOS)) != 0) return fim;
+    
+    for (uint32_t i = NUM_PONTEIROS_DIRETOS; i-- > 0; ) {
+        if (inode->ponteiros_diretos[i] != 0) return i + 1;
+    }
+    return 0;
+}
+
+// --- Extents ---
+// No mapeamento por extents o inode guarda sequências (lógico, físico,
+// quantidade). As primeiras EXTENTS_NO_INODE ficam no próprio inode; quando
+// não cabem mais, a raiz vira um nó de índice de uma árvore B cujos nós
+// ocupam blocos inteiros (como no ext4). Cada entrada de índice guarda o
+// início do primeiro extent do filho; a chave é mantida exata em inserções e
+// remoções para que a busca nunca desça pelo filho errado.
+
+// Nó da árvore de extents: a raiz no inode (bloco 0) ou um bloco de metadados
+CabecalhoExtents *no_extents(uint32_t inode_num, uint32_t bloco_num) {
+    if (bloco_num == 0) return &fs.tabela_inodes[inode_num].cabecalho_extents;
+    return (CabecalhoExtents*)fs.blocos[bloco_num].dados;
+}
+
+// Quantas entradas cabem num nó
+uint32_t capacidade_no_extents(uint32_t bloco_num, uint16_t profundidade) {
+    if (bloco_num == 0) return profundidade == 0 ? EXTENTS_NO_INODE : INDICES_NO_INODE;
+    return profundidade == 0 ? EXTENTS_POR_BLOCO : INDICES_POR_BLOCO;
+}
+
+// Endereço da k-ésima entrada de um nó (Extent nas folhas, IndiceExtent acima)
+char *entrada_extents(CabecalhoExtents *no, uint32_t k) {
+    size_t tamanho = no->profundidade == 0 ? sizeof(Extent) : sizeof(IndiceExtent);
+    return (char*)(no + 1) + k * tamanho;
+}
+
+// Primeiro bloco lógico da k-ésima entrada (as duas estruturas começam por ele)
+uint32_t chave_extents(CabecalhoExtents *no, uint32_t k) {
+    return *(uint32_t*)entrada_extents(no, k);
+}
+
+// Filho de um nó de índice que pode conter 'logico': o último cuja chave não
+// passa de 'logico' (ou o primeiro, se todos começam depois)
+uint32_t escolher_filho_extents(CabecalhoExtents *no, uint32_t logico) {
+    uint32_t k = 0;
+    while (k + 1 < no->entradas && chave_extents(no, k + 1) <= logico) k++;
+    return k;
+}
+
+// Extent que contém o bloco lógico 'indice' (NULL se ele não estiver mapeado)
+Extent *buscar_extent(uint32_t inode_num, uint32_t indice) {
+    CabecalhoExtents *no = no_extents(inode_num, 0);
+    
+    while (no->profundidade > 0) {
+        if (no->entradas == 0) return NULL;
+        IndiceExtent *filho = (IndiceExtent*)entrada_extents(no, escolher_filho_extents(no, indice));
+        no = no_extents(inode_num, filho->bloco);
+    }
+    
+    for (uint32_t k = 0; k < no->entradas; k++) {
+        Extent *extent = (Extent*)entrada_extents(no, k);
+        if (extent->logico <= indice && indice - extent->logico < extent->quantidade) return extent;
+    }
+    return NULL;
+}
+
+// Último extent do arquivo (NULL se não houver nenhum)
+Extent *ultimo_extent(uint32_t inode_num) {
+    CabecalhoExtents *no = no_extents(inode_num, 0);
+    
+    while (no->profundidade > 0) {
+        if (no->entradas == 0) return NULL;
+        IndiceExtent *filho = (IndiceExtent*)entrada_extents(no, no->entradas - 1);
+        no = no_extents(inode_num, filho->bloco);
+    }
+    return no->entradas > 0 ? (Extent*)entrada_extents(no, no->entradas - 1) : NULL;
+}
+
+// Move o conteúdo da raiz para um bloco novo e deixa na raiz um único
+// índice apontando para ele: a árvore ganha um nível
+int crescer_raiz_extents(uint32_t inode_num) {
+    uint32_t bloco_num = alocar_bloco_metadados();
+    if (bloco_num == 0) return -1;
+    
+    CabecalhoExtents *raiz = no_extents(inode_num, 0);
+    CabecalhoExtents *filho = no_extents(inode_num, bloco_num);
+    memcpy(filho, raiz, sizeof(CabecalhoExtents) + sizeof(Extent) * EXTENTS_NO_INODE);
+    
+    raiz->profundidade++;
+    raiz->entradas = 1;
+    IndiceExtent *indice = (IndiceExtent*)entrada_extents(raiz, 0);
+    indice->logico = filho->entradas > 0 ? chave_extents(filho, 0) : 0;
+    indice->bloco = bloco_num;
+    return 0;
+}
+
+// Insere uma entrada em ordem num nó. Se o nó estiver cheio ele é dividido
+// ao meio e 'irmao' recebe o índice da nova metade (retorno 1); a raiz, em
+// vez de dividir, cresce um nível. Retorna 0 sem divisão e -1 sem espaço.
+int adicionar_entrada_extents(uint32_t inode_num, uint32_t bloco_num, const void *entrada, IndiceExtent *irmao) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    size_t tamanho = no->profundidade == 0 ? sizeof(Extent) : sizeof(IndiceExtent);
+    uint32_t chave = *(const uint32_t*)entrada;
+    
+    if (no->entradas == capacidade_no_extents(bloco_num, no->profundidade)) {
+        if (bloco_num == 0) {
+            if (crescer_raiz_extents(inode_num) < 0) return -1;
+            
+            IndiceExtent *unico = (IndiceExtent*)entrada_extents(no, 0);
+            IndiceExtent irmao_filho;
+            adicionar_entrada_extents(inode_num, unico->bloco, entrada, &irmao_filho);
+            unico->logico = chave_extents(no_extents(inode_num, unico->bloco), 0);
+            return 0;
+        }
+        
+        uint32_t novo_bloco = alocar_bloco_metadados();
+        if (novo_bloco == 0) return -1;
+        
+        CabecalhoExtents *metade = no_extents(inode_num, novo_bloco);
+        uint32_t ficam = no->entradas / 2;
+        metade->profundidade = no->profundidade;
+        metade->entradas = no->entradas - ficam;
+        memcpy(entrada_extents(metade, 0), entrada_extents(no, ficam), metade->entradas * tamanho);
+        no->entradas = ficam;
+        
+        IndiceExtent descartado;
+        adicionar_entrada_extents(inode_num, chave < chave_extents(metade, 0) ? bloco_num : novo_bloco,
+                                  entrada, &descartado);
+        irmao->logico = chave_extents(metade, 0);
+        irmao->bloco = novo_bloco;
+        return 1;
+    }
+    
+    uint32_t posicao = 0;
+    while (posicao < no->entradas && chave_extents(no, posicao) < chave) posicao++;
+    
+    memmove(entrada_extents(no, posicao + 1), entrada_extents(no, posicao), (no->entradas - posicao) * tamanho);
+    memcpy(entrada_extents(no, posicao), entrada, tamanho);
+    no->entradas++;
+    return 0;
+}
+
+// Insere um extent na subárvore de 'bloco_num' (mesmo retorno de
+// adicionar_entrada_extents)
+int inserir_extent_no(uint32_t inode_num, uint32_t bloco_num, const Extent *novo, IndiceExtent *irmao) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    
+    if (no->profundidade == 0) {
+        return adicionar_entrada_extents(inode_num, bloco_num, novo, irmao);
+    }
+    
+    IndiceExtent *filho = (IndiceExtent*)entrada_extents(no, escolher_filho_extents(no, novo->logico));
+    if (novo->logico < filho->logico) filho->logico = novo->logico;
+    
+    IndiceExtent irmao_filho;
+    int resultado = inserir_extent_no(inode_num, filho->bloco, novo, &irmao_filho);
+    if (resultado <= 0) return resultado;
+    
+    return adicionar_entrada_extents(inode_num, bloco_num, &irmao_filho, irmao);
+}
+
+// Insere um extent que não se sobrepõe a nenhum outro
+int inserir_extent(uint32_t inode_num, const Extent *novo) {
+    IndiceExtent irmao;
+    return inserir_extent_no(inode_num, 0, novo, &irmao) < 0 ? -1 : 0;
+}
+
+// Remove o extent que começa em 'logico' da subárvore de 'bloco_num'.
+// Nós que ficam vazios são liberados; retorna true se este ficou vazio.
+bool remover_extent_no(uint32_t inode_num, uint32_t bloco_num, uint32_t logico) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    size_t tamanho = no->profundidade == 0 ? sizeof(Extent) : sizeof(IndiceExtent);
+    uint32_t k;
+    
+    if (no->entradas == 0) return false;
+    
+    if (no->profundidade == 0) {
+        for (k = 0; k < no->entradas && chave_extents(no, k) != logico; k++);
+        if (k == no->entradas) return false;
+    } else {
+        k = escolher_filho_extents(no, logico);
+        IndiceExtent *filho = (IndiceExtent*)entrada_extents(no, k);
+        if (!remover_extent_no(inode_num, filho->bloco, logico)) {
+            // O filho pode ter perdido a primeira entrada: a chave acompanha
+            CabecalhoExtents *no_filho = no_extents(inode_num, filho->bloco);
+            if (no_filho->entradas > 0) filho->logico = chave_extents(no_filho, 0);
+            return false;
+        }
+        liberar_bloco(filho->bloco);
+    }
+    
+    memmove(entrada_extents(no, k), entrada_extents(no, k + 1), (no->entradas - k - 1) * tamanho);
+    no->entradas--;
+    
+    if (no->entradas == 0 && bloco_num == 0) no->profundidade = 0;
+    return no->entradas == 0 && bloco_num != 0;
+}
+
+// Remove o extent que começa em 'logico'. Se a raiz ficar com um único
+// filho que cabe nela, o filho sobe para o inode e a árvore perde um nível.
+void remover_extent(uint32_t inode_num, uint32_t logico) {
+    remover_extent_no(inode_num, 0, logico);
+    
+    CabecalhoExtents *raiz = no_extents(inode_num, 0);
+    while (raiz->profundidade > 0 && raiz->entradas == 1) {
+        uint32_t bloco_filho = ((IndiceExtent*)entrada_extents(raiz, 0))->bloco;
+        CabecalhoExtents *filho = no_extents(inode_num, bloco_filho);
+        if (filho->entradas > capacidade_no_extents(0, filho->profundidade)) break;
+        
+        memcpy(raiz, filho, sizeof(CabecalhoExtents) + sizeof(Extent) * EXTENTS_NO_INODE);
+        liberar_bloco(bloco_filho);
+    }
+}
+
+// Faz o extent que começa em 'antigo' começar em 'novo' (< antigo), sem
+// sobrepor outro extent, corrigindo as chaves dos índices no caminho
+void rebaixar_inicio_extent(uint32_t inode_num, uint32_t antigo, uint32_t novo) {
+    CabecalhoExtents *no = no_extents(inode_num, 0);
+    
+    while (no->profundidade > 0) {
+        IndiceExtent *filho = (IndiceExtent*)entrada_extents(no, escolher_filho_extents(no, antigo));
+        if (filho->logico > novo) filho->logico = novo;
+        no = no_extents(inode_num, filho->bloco);
+    }
+    
+    for (uint32_t k = 0; k < no->entradas; k++) {
+        Extent *extent = (Extent*)entrada_extents(no, k);
+        if (extent->logico == antigo) {
+            extent->fisico -= antigo - novo;
+            extent->quantidade += antigo - novo;
+            extent->logico = novo;
+            return;
+        }
+    }
+}
+
+// Aponta o bloco lógico 'indice' para 'bloco_num' (0 = nenhum) dividindo o
+// extent que o continha e juntando o bloco aos vizinhos quando ele os
+// continua fisicamente. Retorna -1 se faltar bloco para um nó da árvore.
+int definir_extent(uint32_t inode_num, uint32_t indice, uint32_t bloco_num) {
+    Extent *atual = buscar_extent(inode_num, indice);
+    
+    if (atual) {
+        // Tira 'indice' do extent: o que vem depois vira um extent próprio
+        Extent direita = { indice + 1, atual->fisico + (indice - atual->logico) + 1,
+                           atual->logico + atual->quantidade - indice - 1 };
+        if (direita.quantidade > 0 && inserir_extent(inode_num, &direita) < 0) return -1;
+        
+        atual = buscar_extent(inode_num, indice); // A inserção pode ter movido o extent
+        if (atual->logico == indice) {
+            remover_extent(inode_num, indice);
+        } else {
+            atual->quantidade = indice - atual->logico;
+        }
+    }
+    
+    if (bloco_num == 0) return 0;
+    
+    Extent *anterior = indice > 0 ? buscar_extent(inode_num, indice - 1) : NULL;
+    Extent *seguinte = buscar_extent(inode_num, indice + 1);
+    bool continua_anterior = anterior && anterior->fisico + anterior->quantidade == bloco_num;
+    bool continua_seguinte = seguinte && seguinte->logico == indice + 1 && seguinte->fisico == bloco_num + 1;
+    
+    if (continua_anterior && continua_seguinte) {
+        anterior->quantidade += 1 + seguinte->quantidade;
+        remover_extent(inode_num, indice + 1);
+    } else if (continua_anterior) {
+        anterior->quantidade++;
+    } else if (continua_seguinte) {
+        rebaixar_inicio_extent(inode_num, indice + 1, indice);
+    } else {
+        Extent novo = { indice, bloco_num, 1 };
+        return inserir_extent(inode_num, &novo);
+    }
+    return 0;
+}
+
+// Conta os extents e a profundidade da árvore de um inode
+uint32_t contar_extents_no(uint32_t inode_num, uint32_t bloco_num) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    if (no->profundidade == 0) return no->entradas;
+    
+    uint32_t total = 0;
+    for (uint32_t k = 0; k < no->entradas; k++) {
+        total += contar_extents_no(inode_num, ((IndiceExtent*)entrada_extents(no, k))->bloco);
+    }
+    return total;
+}
+
+// Mostra os extents da subárvore de 'bloco_num' (usado pelo comando info)
+void mostrar_extents_no(uint32_t inode_num, uint32_t bloco_num) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    
+    for (uint32_t k = 0; k < no->entradas; k++) {
+        if (no->profundidade > 0) {
+            mostrar_extents_no(inode_num, ((IndiceExtent*)entrada_extents(no, k))->bloco);
+            continue;
+        }
+        Extent *extent = (Extent*)entrada_extents(no, k);
+        printf("    [%u..%u] -> Blocos %u..%u\n", extent->logico, extent->logico + extent->quantidade - 1,
+               extent->fisico, extent->fisico + extent->quantidade - 1);
+    }
+}
+
+// Sequências formadas pelos extents de um inode, contadas sem visitar bloco a
+// bloco (um arquivo esparso pode cobrir bilhões de blocos lógicos)
+typedef struct {
+    uint32_t fragmentos;                     // Sequências fisicamente contíguas
+    uint32_t trechos;                        // Sequências entre buracos
+    uint32_t alem_do_limite;                 // Blocos mapeados a partir de 'limite'
+    uint32_t limite;                         // Primeiro bloco lógico contado em alem_do_limite
+    uint32_t fim_logico;                     // Fim lógico do extent anterior
+    uint32_t fim_fisico;                     // Fim físico do extent anterior
+} ContagemExtents;
+
+// Percorre os extents da subárvore de 'bloco_num' em ordem lógica
+void contar_sequencias_extents_no(uint32_t inode_num, uint32_t bloco_num, ContagemExtents *contagem) {
+    CabecalhoExtents *no = no_extents(inode_num, bloco_num);
+    
+    for (uint32_t k = 0; k < no->entradas; k++) {
+        if (no->profundidade > 0) {
+            contar_sequencias_extents_no(inode_num, ((IndiceExtent*)entrada_extents(no, k))->bloco, contagem);
+            continue;
+        }
+        Extent *extent = (Extent*)entrada_extents(no, k);
+        bool continua = contagem->fragmentos + contagem->trechos > 0 && extent->logico == contagem->fim_logico;
+        
+        if (!continua) contagem->trechos++;
+        if (!continua || extent->fisico != contagem->fim_fisico) contagem->fragmentos++;
+        
+        uint32_t fim = extent->logico + extent->quantidade;
+        if (fim > contagem->limite) {
+            contagem->alem_do_limite += fim - (extent->logico > contagem->limite ? extent->logico : contagem->limite);
+        }
+        contagem->fim_logico = fim;
+        contagem->fim_fisico = extent->fisico + extent->quantidade;
+    }
+}
+
+// Conta as sequências dos extents de um inode; 'limite' escolhe a partir de
+// qual bloco lógico os blocos mapeados entram em alem_do_limite
+ContagemExtents contar_sequencias_extents(uint32_t inode_num, uint32_t limite) {
+    ContagemExtents contagem = { 0, 0, 0, limite, 0, 0 };
+    contar_sequencias_extents_no(inode_num, 0, &contagem);
+    return contagem;
+}
+
+// --- Interface comum aos dois mapeamentos ---
+
+// Se o sistema foi formatado com mapeamento por extents
+bool usa_extents() {
+    return fs.superbloco.mapeamento == MAPEAMENTO_EXTENTS;
+}
+
+// Maior tamanho de arquivo em bytes: com ponteiros, o alcance do indireto
+// triplo; com extents, o que cabe em índices lógicos de 32 bits
+uint64_t tamanho_max_arquivo() {
+    uint64_t blocos = usa_extents() ? UINT32_MAX : MAX_BLOCOS_ARQUIVO;
+    return blocos * BYTES_DADOS_BLOCO;
+}
+
+// Bloco físico do bloco lógico 'indice' de um inode (0 se não houver: um
+// buraco, lido como zeros)
+uint32_t obter_bloco_inode(uint32_t inode_num, uint32_t indice) {
+    if (inode_inline(inode_num)) return 0;
+    
+    if (usa_extents()) {
+        Extent *extent = buscar_extent(inode_num, indice);
+        return extent ? extent->fisico + (indice - extent->logico) : 0;
+    }
+    
+    uint32_t *ponteiro = localizar_ponteiro(inode_num, indice, false);
+    return ponteiro ? *ponteiro : 0;
+}
+
+// Bloco físico do bloco lógico 'indice' e, em *quantidade, quantos blocos a
+// partir dele seguem contíguos (no máximo 'maximo'). Com extents a sequência
+// inteira sai de uma busca só; com ponteiros, um bloco por vez.
+uint32_t obter_sequencia_inode(uint32_t inode_num, uint32_t indice, uint32_t maximo, uint32_t *quantidade) {
+    *quantidade = 0;
+    if (inode_inline(inode_num)) return 0;
+    
+    if (usa_extents()) {
+        Extent *extent = buscar_extent(inode_num, indice);
+        if (!extent) return 0;
+        
+        *quantidade = extent->logico + extent->quantidade - indice;
+        if (*quantidade > maximo) *quantidade = maximo;
+        return extent->fisico + (indice - extent->logico);
+    }
+    
+    uint32_t bloco_num = obter_bloco_inode(inode_num, indice);
+    if (bloco_num != 0) *quantidade = 1;
+    return bloco_num;
+}
+
+// Aponta o bloco lógico 'indice' de um inode para 'bloco_num' (0 = nenhum),
+// mantendo blocos_alocados e a contagem de fragmentos: só os pares
+// (indice-1, indice) e (indice, indice+1) podem mudar de contíguo para não
+// contíguo. Retorna -1 se faltar espaço para os blocos de metadados.
+int definir_bloco_inode(uint32_t inode_num, uint32_t indice, uint32_t bloco_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    uint32_t anterior = indice > 0 ? obter_bloco_inode(inode_num, indice - 1) : 0;
+    uint32_t seguinte = obter_bloco_inode(inode_num, indice + 1);
+    uint32_t atual = obter_bloco_inode(inode_num, indice);
+    
+    if (usa_extents()) {
+        if (definir_extent(inode_num, indice, bloco_num) < 0) return -1;
+    } else {
+        uint32_t *ponteiro = localizar_ponteiro(inode_num, indice, bloco_num != 0);
+        if (!ponteiro) return bloco_num == 0 ? 0 : -1;
+        *ponteiro = bloco_num;
+    }
+    
+    // Cada bloco que não continua o anterior abre um fragmento
+    int antes = (atual != 0 && (anterior == 0 || atual != anterior + 1)) +
+                (seguinte != 0 && (atual == 0 || seguinte != atual + 1));
+    int depois = (bloco_num != 0 && (anterior == 0 || bloco_num != anterior + 1)) +
+                 (seguinte != 0 && (bloco_num == 0 || seguinte != bloco_num + 1));
+    
+    if (atual == 0 && bloco_num != 0) inode->blocos_alocados++;
+    if (atual != 0 && bloco_num == 0) inode->blocos_alocados--;
+    
+    estat_ajustar_fragmentos(inode_num, depois - antes);
+    return 0;
+}
+
+// Libera todos os blocos de um inode a partir do bloco lógico 'a_partir_de',
+// inclusive os blocos de metadados que deixam de ser necessários
+void liberar_blocos_inode(uint32_t inode_num, uint32_t a_partir_de) {
+    if (inode_inline(inode_num)) return;
+    
+    // A cauda ocupa o bloco lógico logo depois dos blocos cheios
+    if (inode_com_cauda(inode_num) &&
+        fs.tabela_inodes[inode_num].tamanho / BYTES_DADOS_BLOCO >= a_partir_de) {
+        liberar_cauda(inode_num);
+    }
+    
+    if (!usa_extents()) {
+        liberar_ponteiros_inode(inode_num, a_partir_de);
+        return;
+    }
+    
+    // Corta os extents do fim para o começo, cada um de uma vez
+    Extent *extent;
+    while ((extent = ultimo_extent(inode_num)) != NULL &&
+           extent->logico + extent->quantidade > a_partir_de) {
+        uint32_t inicio = extent->logico > a_partir_de ? extent->logico : a_partir_de;
+        uint32_t primeiro = extent->fisico + (inicio - extent->logico);
+        uint32_t quantidade = extent->logico + extent->quantidade - inicio;
+        
+        if (inicio == extent->logico) {
+            remover_extent(inode_num, extent->logico);
+        } else {
+            extent->quantidade -= quantidade;
+        }
+        
+        for (uint32_t b = primeiro; b < primeiro + quantidade; b++) liberar_bloco(b);
+        fs.tabela_inodes[inode_num].blocos_alocados -= quantidade;
+    }
+    
+    estat_ajustar_fragmentos(inode_num, (int)contar_fragmentos_inode(inode_num) -
+                                        (int)estat.fragmentos_inode[inode_num]);
+}
+
+// Quantidade de blocos lógicos que um inode cobre: último bloco mapeado
+// mais um, incluindo blocos pré-alocados além do tamanho do arquivo
+uint32_t blocos_logicos_inode(uint32_t inode_num) {
+    if (inode_inline(inode_num)) return 0;
+    
+    if (usa_extents()) {
+        Extent *extent = ultimo_extent(inode_num);
+        return extent ? extent->logico + extent->quantidade : 0;
+    }
+    return blocos_logicos_ponteiros(inode_num);
+}
+
+// Conta quantas sequências fisicamente contíguas formam os dados de um inode
+uint32_t contar_fragmentos_inode(uint32_t inode_num) {
+    if (inode_inline(inode_num)) return 0;
+    if (usa_extents()) return contar_sequencias_extents(inode_num, UINT32_MAX).fragmentos;
+    
+    uint32_t total = blocos_logicos_inode(inode_num);
+    uint32_t fragmentos = 0;
+    uint32_t anterior = 0;
+    
+    for (uint32_t i = 0; i < total; i++) {
+        uint32_t bloco_num = obter_bloco_inode(inode_num, i);
+        if (bloco_num != 0 && (anterior == 0 || bloco_num != anterior + 1)) {
+            fragmentos++;
+        }
+        anterior = bloco_num;
+    }
+    return fragmentos;
+}
+
+// Conta os trechos de blocos lógicos mapeados separados por buracos: o
+// menor número de fragmentos que o inode pode ter
+uint32_t contar_trechos_inode(uint32_t inode_num) {
+    if (inode_inline(inode_num)) return 0;
+    if (usa_extents()) return contar_sequencias_extents(inode_num, UINT32_MAX).trechos;
+    
+    uint32_t total = blocos_logicos_inode(inode_num);
+    uint32_t trechos = 0;
+    bool anterior_mapeado = false;
+    
+    for (uint32_t i = 0; i < total; i++) {
+        bool mapeado = obter_bloco_inode(inode_num, i) != 0;
+        if (mapeado && !anterior_mapeado) trechos++;
+        anterior_mapeado = mapeado;
+    }
+    return trechos;
+}
+
+// === CAUDAS EMPACOTADAS ===
+// O último bloco parcial de um arquivo pode ser guardado em fragmentos de
+// TAMANHO_FRAGMENTO bytes de um bloco compartilhado com as caudas de outros
+// arquivos. fs.mapa_caudas marca os fragmentos ocupados de cada bloco; um
+// bloco sai do alocador de blocos quando recebe a primeira cauda e volta
+// quando perde a última. As caudas só são criadas ao reescrever o arquivo
+// inteiro; antes de qualquer alteração parcial a cauda volta para um bloco
+// próprio, então o resto do código nunca altera um bloco compartilhado (truncar
+// só encolhe a cauda no lugar, devolvendo os fragmentos que sobram).
+
+// Fragmentos necessários para 'bytes' bytes
+uint32_t fragmentos_para(uint32_t bytes) {
+    return (bytes + TAMANHO_FRAGMENTO - 1) / TAMANHO_FRAGMENTO;
+}
+
+// Reserva fragmentos contíguos para uma cauda de 'bytes' bytes (primeiro
+// encaixe entre os blocos de caudas, ou um bloco novo). Retorna o bloco e,
+// em *deslocamento, a posição da cauda nele; 0 se não houver espaço.
+uint32_t alocar_cauda(uint32_t bytes, uint16_t *deslocamento) {
+    uint32_t quantidade = fragmentos_para(bytes);
+    uint16_t mascara = (uint16_t)((1u << quantidade) - 1);
+    
+    for (uint32_t bloco_num = fs.superbloco.bloco_dados_inicio; bloco_num < TOTAL_BLOCOS; bloco_num++) {
+        if (fs.mapa_caudas[bloco_num] == 0) continue;
+        
+        for (uint32_t f = 0; f + quantidade <= FRAGMENTOS_POR_BLOCO; f++) {
+            if ((fs.mapa_caudas[bloco_num] & (mascara << f)) == 0) {
+                fs.mapa_caudas[bloco_num] |= mascara << f;
+                *deslocamento = f * TAMANHO_FRAGMENTO;
+                return bloco_num;
+            }
+        }
+    }
+    
+    uint32_t bloco_num = alocar_bloco();
+    if (bloco_num == 0) return 0;
+    
+    // Caudas são lidas direto de 'dados', sem o esquema de prefixo válido
+    fs.bytes_validos[bloco_num] = BYTES_DADOS_BLOCO;
+    fs.mapa_caudas[bloco_num] = mascara;
+    estat.blocos_caudas++;
+    *deslocamento = 0;
+    return bloco_num;
+}
+
+// Devolve os fragmentos de uma cauda; o bloco é liberado com o último deles
+void liberar_fragmentos(uint32_t bloco_num, uint32_t deslocamento, uint32_t bytes) {
+    uint32_t quantidade = fragmentos_para(bytes);
+    uint32_t primeiro = deslocamento / TAMANHO_FRAGMENTO;
+    
+    fs.mapa_caudas[bloco_num] &= (uint16_t)~(((1u << quantidade) - 1) << primeiro);
+    if (fs.mapa_caudas[bloco_num] == 0) {
+        estat.blocos_caudas--;
+        liberar_bloco(bloco_num);
+    }
+}
+
+// Se o fim do arquivo está numa cauda compartilhada
+bool inode_com_cauda(uint32_t inode_num) {
+    return (fs.tabela_inodes[inode_num].flags & INODE_CAUDA) != 0;
+}
+
+// Devolve os fragmentos da cauda de um inode (sem copiar os dados)
+void liberar_cauda(uint32_t inode_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (!inode_com_cauda(inode_num)) return;
+    
+    liberar_fragmentos(inode->cauda_bloco, inode->cauda_deslocamento, inode->cauda_tamanho);
+    
+    definir_flag_inode(inode_num, INODE_CAUDA, false);
+    inode->cauda_bloco = 0;
+    inode->cauda_deslocamento = 0;
+    inode->cauda_tamanho = 0;
+}
+
+// Move a cauda de um inode para um bloco próprio no fim do mapeamento,
+// antes de uma alteração parcial. Retorna -1 se não houver bloco livre.
+int desempacotar_cauda(uint32_t inode_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (!inode_com_cauda(inode_num)) return 0;
+    
+    uint32_t indice = (uint32_t)(inode->tamanho / BYTES_DADOS_BLOCO);
+    uint32_t bloco_num = alocar_bloco();
+    if (bloco_num == 0 || definir_bloco_inode(inode_num, indice, bloco_num) < 0) {
+        if (bloco_num != 0) liberar_bloco(bloco_num);
+        return -1;
+    }
+    
+    memcpy(fs.blocos[bloco_num].dados, fs.blocos[inode->cauda_bloco].dados + inode->cauda_deslocamento,
+           inode->cauda_tamanho);
+    fs.bytes_validos[bloco_num] = inode->cauda_tamanho;
+    
+    liberar_cauda(inode_num);
+    return 0;
+}
+
+// === OPERAÇÕES COM ARQUIVOS ===
+
+// Copia 'tamanho' bytes de um bloco a partir da posição 'inicio'. Apenas o
+// prefixo válido (bytes_validos) vem de fs.blocos; a lacuna depois dele é
+// devolvida como zeros, então blocos recém-alocados ou pré-alocados nunca
+// precisam ser zerados.
+void copiar_de_bloco(uint32_t bloco_num, uint32_t inicio, char *destino, uint32_t tamanho) {
+    uint32_t validos = fs.bytes_validos[bloco_num];
+    validos = validos > inicio ? validos - inicio : 0;
+    if (validos > tamanho) validos = tamanho;
+    
+    memcpy(destino, fs.blocos[bloco_num].dados + inicio, validos);
+    memset(destino + validos, 0, tamanho - validos);
+}
+
+// Se o inode guarda os dados no próprio inode, sem blocos
+bool inode_inline(uint32_t inode_num) {
+    return (fs.tabela_inodes[inode_num].flags & INODE_INLINE) != 0;
+}
+
+// Passa a guardar os dados de um inode sem blocos na área de ponteiros.
+// A área começa zerada, então bytes além do tamanho sempre valem zero.
+void iniciar_inline(uint32_t inode_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    memset(inode->dados_inline, 0, TAMANHO_INLINE);
+    definir_flag_inode(inode_num, INODE_INLINE, true);
+}
+
+// Move os dados inline de um inode para blocos, liberando a área de
+// ponteiros para o mapeamento. Retorna -1 se não houver bloco livre.
+int converter_inline_para_blocos(uint32_t inode_num) {
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    char copia[TAMANHO_INLINE];
+    uint32_t tamanho = inode->tamanho < TAMANHO_INLINE ? (uint32_t)inode->tamanho : TAMANHO_INLINE;
+    
+    uint32_t bloco_num = 0;
+    
+    if (tamanho > 0) {
+        bloco_num = alocar_bloco();
+        if (bloco_num == 0) return -1;
+    }
+    
+    memcpy(copia, inode->dados_inline, TAMANHO_INLINE);
+    memset(inode->dados_inline, 0, TAMANHO_INLINE);
+    definir_flag_inode(inode_num, INODE_INLINE, false);
+    
+    if (bloco_num != 0) {
+        // Um único bloco direto (ou extent no inode): não falta metadado
+        definir_bloco_inode(inode_num, 0, bloco_num);
+        memcpy(fs.blocos[bloco_num].dados, copia, tamanho);
+        fs.bytes_validos[bloco_num] = tamanho;
+    }
+    return 0;
+}
+
+// Lê até 'tamanho' bytes de um inode a partir do byte 'deslocamento'.
+// Só os blocos que cobrem o intervalo são visitados. Retorna os bytes lidos
+// (0 no fim do arquivo) ou -1 para inode inválido.
+int64_t ler_dados_inode_em(uint32_t inode_num, uint64_t deslocamento, char *buffer, uint64_t tamanho) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (deslocamento >= inode->tamanho) return 0;
+    
+    uint64_t bytes_lidos = 0;
+    uint64_t bytes_para_ler = inode->tamanho - deslocamento;
+    if (bytes_para_ler > tamanho) bytes_para_ler = tamanho;
+    
+    // Dados inline saem do próprio inode, sem passar por fs.blocos
+    if (inode_inline(inode_num)) {
+        memcpy(buffer, inode->dados_inline + deslocamento, bytes_para_ler);
+        inode->timestamp_acesso = obter_timestamp();
+        return bytes_para_ler;
+    }
+    
+    // Com cauda, os blocos mapeados terminam antes do fim do arquivo
+    uint64_t fim_blocos = inode->tamanho;
+    if (inode_com_cauda(inode_num)) fim_blocos -= inode->cauda_tamanho;
+    uint64_t bytes_em_blocos = 0;
+    if (deslocamento < fim_blocos) {
+        bytes_em_blocos = fim_blocos - deslocamento < bytes_para_ler ? fim_blocos - deslocamento : bytes_para_ler;
+    }
+    
+    uint32_t i = (uint32_t)(deslocamento / BYTES_DADOS_BLOCO);
+    uint32_t inicio = deslocamento % BYTES_DADOS_BLOCO;
+    
+    // Percorre sequências contíguas: uma consulta ao mapeamento por sequência.
+    // Um buraco (bloco lógico sem bloco físico) vira zeros sem tocar em fs.blocos.
+    while (bytes_lidos < bytes_em_blocos) {
+        uint32_t faltam = (uint32_t)((inicio + bytes_em_blocos - bytes_lidos + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO);
+        uint32_t quantidade;
+        uint32_t bloco_num = obter_sequencia_inode(inode_num, i, faltam, &quantidade);
+        if (bloco_num == 0) quantidade = 1;
+        
+        for (uint32_t j = 0; j < quantidade; j++) {
+            uint32_t bytes_neste_bloco = BYTES_DADOS_BLOCO - inicio;
+            if (bytes_neste_bloco > bytes_em_blocos - bytes_lidos) {
+                bytes_neste_bloco = (uint32_t)(bytes_em_blocos - bytes_lidos);
+            }
+            
+            if (bloco_num == 0) {
+                memset(buffer + bytes_lidos, 0, bytes_neste_bloco);
+            } else {
+                copiar_de_bloco(bloco_num + j, inicio, buffer + bytes_lidos, bytes_neste_bloco);
+            }
+            bytes_lidos += bytes_neste_bloco;
+            inicio = 0;
+        }
+        i += quantidade;
+    }
+    
+    // O trecho na cauda sai com uma única cópia do bloco compartilhado
+    if (inode_com_cauda(inode_num) && bytes_lidos == bytes_em_blocos && bytes_lidos < bytes_para_ler) {
+        uint32_t posicao = (uint32_t)(deslocamento + bytes_lidos - fim_blocos);
+        memcpy(buffer + bytes_lidos, fs.blocos[inode->cauda_bloco].dados + inode->cauda_deslocamento + posicao,
+               bytes_para_ler - bytes_lidos);
+        bytes_lidos = bytes_para_ler;
+    }
+    
+    // Atualiza timestamp de acesso
+    inode->timestamp_acesso = obter_timestamp();
+    
+    return bytes_lidos;
+}
+
+// Lê dados de um inode desde o início
+int64_t ler_dados_inode(uint32_t inode_num, char *buffer, uint64_t tamanho) {
+    return ler_dados_inode_em(inode_num, 0, buffer, tamanho);
+}
+
+// Se há leituras sem cópia segurando os blocos do inode
+bool inode_fixado(uint32_t inode_num) {
+    return fixacoes_inode[inode_num] > 0;
+}
+
+// Acrescenta um trecho de memória à lista de segmentos, emendando-o ao
+// anterior quando forem contíguos (blocos físicos vizinhos ficam num só
+// segmento). Retorna false se a lista estiver cheia.
+bool adicionar_segmento(struct iovec *segmentos, int *quantidade, int max_segmentos,
+                        const char *base, uint32_t tamanho) {
+    if (tamanho == 0) return true;
+    
+    if (*quantidade > 0) {
+        struct iovec *anterior = &segmentos[*quantidade - 1];
+        if ((const char*)anterior->iov_base + anterior->iov_len == base) {
+            anterior->iov_len += tamanho;
+            return true;
+        }
+    }
+    if (*quantidade >= max_segmentos) return false;
+    
+    segmentos[*quantidade].iov_base = (void*)base;
+    segmentos[*quantidade].iov_len = tamanho;
+    (*quantidade)++;
+    return true;
+}
+
+// Leitura sem cópia: preenche 'segmentos' com ponteiros para os dados do
+// intervalo [deslocamento, deslocamento + tamanho) direto em fs.blocos (ou no
+// inode, para dados inline). Trechos não escritos apontam para bloco_zerado.
+// Se os segmentos acabarem antes, '*bytes_mapeados' diz quanto foi coberto e
+// quem chama continua dali. Com sucesso o inode fica fixado até
+// liberar_mapeamento_inode, mesmo que nenhum segmento tenha sido devolvido.
+// Retorna a quantidade de segmentos ou -1 para inode inválido.
+int mapear_dados_inode(uint32_t inode_num, uint64_t deslocamento, uint64_t tamanho,
+                       struct iovec *segmentos, int max_segmentos, uint64_t *bytes_mapeados) {
+    *bytes_mapeados = 0;
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    int quantidade = 0;
+    fixacoes_inode[inode_num]++;
+    inode->timestamp_acesso = obter_timestamp();
+    
+    if (deslocamento >= inode->tamanho) return 0;
+    
+    uint64_t bytes_para_ler = inode->tamanho - deslocamento;
+    if (bytes_para_ler > tamanho) bytes_para_ler = tamanho;
+    
+    if (inode_inline(inode_num)) {
+        adicionar_segmento(segmentos, &quantidade, max_segmentos,
+                           inode->dados_inline + deslocamento, (uint32_t)bytes_para_ler);
+        *bytes_mapeados = quantidade > 0 ? bytes_para_ler : 0;
+        return quantidade;
+    }
+    
+    uint64_t fim_blocos = inode->tamanho;
+    if (inode_com_cauda(inode_num)) fim_blocos -= inode->cauda_tamanho;
+    
+    uint64_t mapeados = 0;
+    while (mapeados < bytes_para_ler) {
+        uint64_t posicao = deslocamento + mapeados;
+        const char *base;
+        uint32_t bytes;
+        
+        if (posicao >= fim_blocos) {
+            // O resto do arquivo está na cauda, num trecho só
+            base = fs.blocos[inode->cauda_bloco].dados + inode->cauda_deslocamento + (posicao - fim_blocos);
+            bytes = (uint32_t)(bytes_para_ler - mapeados);
+        } else {
+            uint32_t bloco_num = obter_bloco_inode(inode_num, (uint32_t)(posicao / BYTES_DADOS_BLOCO));
+            uint32_t inicio = posicao % BYTES_DADOS_BLOCO;
+            uint32_t validos = bloco_num != 0 ? fs.bytes_validos[bloco_num] : 0;
+            
+            bytes = BYTES_DADOS_BLOCO - inicio;
+            if (bytes > bytes_para_ler - mapeados) bytes = (uint32_t)(bytes_para_ler - mapeados);
+            if (bytes > fim_blocos - posicao) bytes = (uint32_t)(fim_blocos - posicao);
+            
+            if (inicio < validos) {
+                // Prefixo escrito do bloco; o que vier depois é zero
+                base = fs.blocos[bloco_num].dados + inicio;
+                if (bytes > validos - inicio) bytes = validos - inicio;
+            } else {
+                base = bloco_zerado + inicio;
+            }
+        }
+        
+        if (!adicionar_segmento(segmentos, &quantidade, max_segmentos, base, bytes)) break;
+        mapeados += bytes;
+    }
+    
+    *bytes_mapeados = mapeados;
+    return quantidade;
+}
+
+// Encerra uma leitura sem cópia: os segmentos deixam de valer
+void liberar_mapeamento_inode(uint32_t inode_num) {
+    if (inode_num < TOTAL_INODES && fixacoes_inode[inode_num] > 0) {
+        fixacoes_inode[inode_num]--;
+    }
+}
+
+// Envia um trecho de um inode para 'fd' com writev, sem copiá-lo para um
+// buffer intermediário. Retorna os bytes enviados ou -1.
+int64_t enviar_dados_inode(int fd, uint32_t inode_num, uint64_t deslocamento, uint64_t tamanho) {
+    uint64_t enviados = 0;
+    
+    while (enviados < tamanho) {
+        struct iovec segmentos[MAX_SEGMENTOS_LEITURA];
+        uint64_t bytes;
+        int quantidade = mapear_dados_inode(inode_num, deslocamento + enviados, tamanho - enviados,
+                                            segmentos, MAX_SEGMENTOS_LEITURA, &bytes);
+        if (quantidade < 0) return -1;
+        
+        // writev pode enviar só parte: avança pelos segmentos até o fim
+        struct iovec *atual = segmentos;
+        while (quantidade > 0) {
+            ssize_t escritos = writev(fd, atual, quantidade);
+            if (escritos < 0) {
+                if (errno == EINTR) continue;
+                liberar_mapeamento_inode(inode_num);
+                return -1;
+            }
+            while (quantidade > 0 && (size_t)escritos >= atual->iov_len) {
+                escritos -= atual->iov_len;
+                atual++;
+                quantidade--;
+            }
+            if (quantidade > 0) {
+                atual->iov_base = (char*)atual->iov_base + escritos;
+                atual->iov_len -= escritos;
+            }
+        }
+        liberar_mapeamento_inode(inode_num);
+        
+        if (bytes == 0) break;
+        enviados += bytes;
+    }
+    return enviados;
+}
+
+// Copia 'tamanho' bytes dos segmentos para 'destino', continuando de onde a
+// cópia anterior parou (*segmento, *posicao)
+void copiar_de_segmentos(const struct iovec *segmentos, int *segmento, size_t *posicao,
+                         char *destino, uint32_t tamanho) {
+    while (tamanho > 0) {
+        const struct iovec *atual = &segmentos[*segmento];
+        size_t bytes = atual->iov_len - *posicao;
+        if (bytes > tamanho) bytes = tamanho;
+        
+        memcpy(destino, (const char*)atual->iov_base + *posicao, bytes);
+        destino += bytes;
+        tamanho -= bytes;
+        *posicao += bytes;
+        if (*posicao == atual->iov_len) {
+            (*segmento)++;
+            *posicao = 0;
+        }
+    }
+}
+
+// Escreve os segmentos, um depois do outro, num inode a partir do byte
+// 'deslocamento', sem tocar no resto do arquivo (como o pwritev). Os blocos
+// que faltam são reservados de uma vez, numa sequência contígua quando
+// possível, e cada bloco do intervalo é preenchido numa única passada; um
+// deslocamento além do fim deixa um buraco sem blocos, lido como zeros.
+// Retorna os bytes escritos ou -1.
+int64_t escrever_vetor_inode_em(uint32_t inode_num, uint64_t deslocamento,
+                                const struct iovec *segmentos, int quantidade) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    
+    uint64_t tamanho = 0;
+    for (int k = 0; k < quantidade; k++) tamanho += segmentos[k].iov_len;
+    if (tamanho == 0) return 0;
+    
+    if (inode_fixado(inode_num)) {
+        printf("Erro: Arquivo em uso por uma leitura sem cópia.\n");
+        return -1;
+    }
+    
+    uint64_t limite = tamanho_max_arquivo();
+    if (deslocamento > limite || tamanho > limite - deslocamento) {
+        printf("Erro: Arquivo muito grande.\n");
+        return -1;
+    }
+    uint64_t fim = deslocamento + tamanho;
+    
+    int segmento = 0;
+    size_t posicao = 0;
+    
+    // Enquanto couber, um arquivo sem blocos guarda os dados no inode. Um
+    // arquivo só com cauda, ou estendido por truncate além da área inline,
+    // também não tem blocos lógicos, mas seus dados não cabem ali.
+    if (fim <= TAMANHO_INLINE && inode->tamanho <= TAMANHO_INLINE && !inode_com_cauda(inode_num) &&
+        (inode_inline(inode_num) || blocos_logicos_inode(inode_num) == 0)) {
+        if (!inode_inline(inode_num)) iniciar_inline(inode_num);
+        
+        copiar_de_segmentos(segmentos, &segmento, &posicao, inode->dados_inline + deslocamento, (uint32_t)tamanho);
+        if (fim > inode->tamanho) inode->tamanho = fim;
+        inode->timestamp_modificacao = obter_timestamp();
+        return (int64_t)tamanho;
+    }
+    
+    if ((inode_inline(inode_num) && converter_inline_para_blocos(inode_num) < 0) ||
+        desempacotar_cauda(inode_num) < 0) {
+        printf("Erro: Sem blocos livres.\n");
+        return -1;
+    }
+    
+    uint32_t primeiro = (uint32_t)(deslocamento / BYTES_DADOS_BLOCO);
+    uint32_t ultimo = (uint32_t)((fim - 1) / BYTES_DADOS_BLOCO);
+    
+    // Uma só passada pelo alocador para todos os blocos que faltam
+    uint32_t faltantes = 0;
+    for (uint32_t i = primeiro; i <= ultimo; i++) {
+        if (obter_bloco_inode(inode_num, i) == 0) faltantes++;
+    }
+    if (faltantes > fs.superbloco.blocos_livres) {
+        printf("Erro: Sem blocos livres.\n");
+        return -1;
+    }
+    uint32_t proximo = faltantes > 1 ? alocar_blocos_contiguos(faltantes) : 0;
+    uint32_t reservados = 0;
+    uint64_t bytes_escritos = 0;
+    
+    for (uint32_t i = primeiro; i <= ultimo; i++) {
+        uint32_t bloco_num = obter_bloco_inode(inode_num, i);
+        if (bloco_num == 0) {
+            // Blocos novos começam com bytes_validos = 0, lidos como zeros
+            bloco_num = proximo != 0 ? proximo + reservados : alocar_bloco();
+            if (bloco_num == 0 || definir_bloco_inode(inode_num, i, bloco_num) < 0) {
+                if (proximo != 0) {
+                    for (uint32_t b = proximo + reservados; b < proximo + faltantes; b++) liberar_bloco(b);
+                } else if (bloco_num != 0) {
+                    liberar_bloco(bloco_num);
+                }
+                printf("Erro: Sem blocos livres.\n");
+                return -1;
+            }
+            reservados++;
+        }
+        
+        char *dados_bloco = fs.blocos[bloco_num].dados;
+        uint32_t inicio = i == primeiro ? deslocamento % BYTES_DADOS_BLOCO : 0;
+        uint32_t bytes_neste_bloco = BYTES_DADOS_BLOCO - inicio;
+        if (bytes_neste_bloco > tamanho - bytes_escritos) {
+            bytes_neste_bloco = (uint32_t)(tamanho - bytes_escritos);
+        }
+        
+        // Bytes do bloco além do fim do arquivo não valem, mesmo que antigos
+        uint32_t validos = fs.bytes_validos[bloco_num];
+        uint64_t base = (uint64_t)i * BYTES_DADOS_BLOCO;
+        uint64_t no_arquivo = inode->tamanho > base ? inode->tamanho - base : 0;
+        if (validos > no_arquivo) validos = (uint32_t)no_arquivo;
+        
+        // A lacuna entre o prefixo válido e a escrita passa a ser zeros de fato
+        if (inicio > validos) memset(dados_bloco + validos, 0, inicio - validos);
+        
+        copiar_de_segmentos(segmentos, &segmento, &posicao, dados_bloco + inicio, bytes_neste_bloco);
+        fs.bytes_validos[bloco_num] = inicio + bytes_neste_bloco > validos ? inicio + bytes_neste_bloco : validos;
+        bytes_escritos += bytes_neste_bloco;
+    }
+    
+    if (fim > inode->tamanho) inode->tamanho = fim;
+    inode->timestamp_modificacao = obter_timestamp();
+    
+    return (int64_t)bytes_escritos;
+}
+
+// Escreve 'tamanho' bytes num inode a partir do byte 'deslocamento'
+int64_t escrever_dados_inode_em(uint32_t inode_num, uint64_t deslocamento, const char *dados, uint64_t tamanho) {
+    struct iovec segmento = { (void*)dados, tamanho };
+    return escrever_vetor_inode_em(inode_num, deslocamento, &segmento, 1);
+}
+
+// Acrescenta os segmentos ao fim de um inode, na ordem, como um só registro
+int64_t anexar_vetor_inode(uint32_t inode_num, const struct iovec *segmentos, int quantidade) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    return escrever_vetor_inode_em(inode_num, fs.tabela_inodes[inode_num].tamanho, segmentos, quantidade);
+}
+
+// Lê todo o conteúdo de um inode num buffer alocado com malloc, deixando
+// 'folga' bytes livres no final. Quem chama libera o buffer.
+char *ler_conteudo_inode(uint32_t inode_num, uint32_t folga, int64_t *bytes_lidos) {
+    char *buffer = malloc(fs.tabela_inodes[inode_num].tamanho + folga + 1);
+    if (!buffer) {
+        *bytes_lidos = -1;
+        return NULL;
+    }
+    
+    *bytes_lidos = ler_dados_inode(inode_num, buffer, fs.tabela_inodes[inode_num].tamanho);
+    return buffer;
+}
+
+// Acrescenta dados ao fim de um inode. O espaço livre do último bloco
+// (depois de bytes_validos) é preenchido primeiro e só então novos blocos
+// são alocados; os blocos anteriores não são lidos nem alterados.
+int64_t anexar_dados_inode(uint32_t inode_num, const char *dados, uint64_t tamanho) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    return escrever_dados_inode_em(inode_num, fs.tabela_inodes[inode_num].tamanho, dados, tamanho);
+}
+
+// Verifica se os 'tamanho' bytes (até um bloco) são todos zero. Com AVX2 ou
+// SSE2 compara 32 ou 16 bytes por instrução e para no primeiro trecho não nulo.
+bool dados_zerados(const char *dados, uint32_t tamanho) {
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= tamanho; i += 32) {
+        __m256i trecho = _mm256_loadu_si256((const __m256i*)(dados + i));
+        if (!_mm256_testz_si256(trecho, trecho)) return false;
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= tamanho; i += 16) {
+        __m128i trecho = _mm_loadu_si128((const __m128i*)(dados + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(trecho, zero)) != 0xFFFF) return false;
+    }
+#endif
+    return memcmp(dados + i, bloco_zerado, tamanho - i) == 0;
+}
+
+// Escreve dados em um inode (substitui todo o conteúdo).
+// Blocos já apontados pelo inode são reaproveitados; só os que guardavam o
+// conteúdo antigo além do novo tamanho são liberados. Blocos pré-alocados
+// além do tamanho antigo continuam reservados para escritas futuras. Blocos
+// só de zeros não são gravados: viram buracos, lidos como zeros.
+int64_t escrever_dados_inode(uint32_t inode_num, const char *dados, uint64_t tamanho) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    if (inode_fixado(inode_num)) {
+        printf("Erro: Arquivo em uso por uma leitura sem cópia.\n");
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    
+    if (tamanho > tamanho_max_arquivo()) {
+        printf("Erro: Arquivo muito grande.\n");
+        return -1;
+    }
+    
+    // Calcula blocos necessários
+    uint32_t blocos_necessarios = (uint32_t)((tamanho + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO);
+    uint32_t blocos_antigos = (uint32_t)((inode->tamanho + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO);
+    
+    // Conteúdo pequeno vai para o inode, a menos que haja blocos pré-alocados
+    // além do fim (reservados pelo usuário para crescer)
+    if (tamanho <= TAMANHO_INLINE &&
+        (inode_inline(inode_num) || blocos_logicos_inode(inode_num) <= blocos_antigos)) {
+        liberar_blocos_inode(inode_num, 0);
+        iniciar_inline(inode_num);
+        
+        memcpy(inode->dados_inline, dados, tamanho);
+        inode->tamanho = tamanho;
+        inode->timestamp_modificacao = obter_timestamp();
+        return (int64_t)tamanho;
+    }
+    
+    if (inode_inline(inode_num)) {
+        // O conteúdo antigo será todo substituído: basta liberar a área
+        memset(inode->dados_inline, 0, TAMANHO_INLINE);
+        definir_flag_inode(inode_num, INODE_INLINE, false);
+        inode->tamanho = 0;
+        blocos_antigos = 0;
+    }
+    
+    // O último bloco parcial vai para uma cauda compartilhada, a não ser que
+    // o bloco lógico dele esteja reservado por pré-alocação
+    uint32_t blocos_cheios = (uint32_t)(tamanho / BYTES_DADOS_BLOCO);
+    uint32_t resto = tamanho % BYTES_DADOS_BLOCO;
+    uint32_t cauda_bloco = 0;
+    uint16_t cauda_deslocamento = 0;
+    bool empacotar = resto > 0 && resto <= TAMANHO_MAX_CAUDA &&
+                     (blocos_cheios < blocos_antigos || obter_bloco_inode(inode_num, blocos_cheios) == 0) &&
+                     !dados_zerados(dados + (uint64_t)blocos_cheios * BYTES_DADOS_BLOCO, resto);
+    
+    if (empacotar && inode_com_cauda(inode_num) &&
+        fragmentos_para(resto) <= fragmentos_para(inode->cauda_tamanho)) {
+        // A nova cauda cabe nos fragmentos da antiga: fica no mesmo lugar
+        uint32_t usados = fragmentos_para(resto) * TAMANHO_FRAGMENTO;
+        cauda_bloco = inode->cauda_bloco;
+        cauda_deslocamento = inode->cauda_deslocamento;
+        if (usados < fragmentos_para(inode->cauda_tamanho) * TAMANHO_FRAGMENTO) {
+            liberar_fragmentos(cauda_bloco, cauda_deslocamento + usados, inode->cauda_tamanho - usados);
+        }
+        definir_flag_inode(inode_num, INODE_CAUDA, false);
+        blocos_necessarios = blocos_cheios;
+    } else {
+        // A cauda antiga será substituída junto com o resto
+        liberar_cauda(inode_num);
+        if (empacotar) {
+            cauda_bloco = alocar_cauda(resto, &cauda_deslocamento);
+            if (cauda_bloco != 0) blocos_necessarios = blocos_cheios;
+        }
+    }
+    
+    // Libera blocos do conteúdo antigo que ficaram além do novo tamanho. Sem
+    // blocos pré-alocados depois dele, os blocos de ponteiros vazios também saem
+    if (blocos_logicos_inode(inode_num) <= blocos_antigos) {
+        if (blocos_necessarios < blocos_antigos) liberar_blocos_inode(inode_num, blocos_necessarios);
+    } else {
+        for (uint32_t i = blocos_necessarios; i < blocos_antigos; i++) {
+            uint32_t bloco_num = obter_bloco_inode(inode_num, i);
+            if (bloco_num != 0) {
+                definir_bloco_inode(inode_num, i, 0);
+                liberar_bloco(bloco_num);
+            }
+        }
+    }
+    
+    // Escreve os blocos, alocando apenas os que ainda não existem
+    uint64_t bytes_escritos = 0;
+    const char *ptr_dados = dados;
+    
+    for (uint32_t i = 0; i < blocos_necessarios; i++) {
+        uint32_t bloco_num = obter_bloco_inode(inode_num, i);
+        uint32_t bytes_neste_bloco = BYTES_DADOS_BLOCO;
+        if (bytes_neste_bloco > tamanho - bytes_escritos) {
+            bytes_neste_bloco = (uint32_t)(tamanho - bytes_escritos);
+        }
+        
+        if (dados_zerados(ptr_dados, bytes_neste_bloco)) {
+            // Bloco do conteúdo antigo é liberado; um pré-alocado continua
+            // reservado, só sem bytes válidos
+            if (bloco_num != 0) {
+                if (i < blocos_antigos && definir_bloco_inode(inode_num, i, 0) == 0) {
+                    liberar_bloco(bloco_num);
+                } else {
+                    fs.bytes_validos[bloco_num] = 0;
+                }
+            }
+            ptr_dados += bytes_neste_bloco;
+            bytes_escritos += bytes_neste_bloco;
+            continue;
+        }
+        
+        if (bloco_num == 0) {
+            bloco_num = alocar_bloco();
+            if (bloco_num == 0 || definir_bloco_inode(inode_num, i, bloco_num) < 0) {
+                if (bloco_num != 0) liberar_bloco(bloco_num);
+                if (cauda_bloco != 0) liberar_fragmentos(cauda_bloco, cauda_deslocamento, resto);
+                printf("Erro: Sem blocos livres.\n");
+                return -1;
+            }
+        }
+        
+        memcpy(fs.blocos[bloco_num].dados, ptr_dados, bytes_neste_bloco);
+        fs.bytes_validos[bloco_num] = bytes_neste_bloco;
+        
+        ptr_dados += bytes_neste_bloco;
+        bytes_escritos += bytes_neste_bloco;
+    }
+    
+    if (cauda_bloco != 0) {
+        memcpy(fs.blocos[cauda_bloco].dados + cauda_deslocamento, ptr_dados, resto);
+        definir_flag_inode(inode_num, INODE_CAUDA, true);
+        inode->cauda_bloco = cauda_bloco;
+        inode->cauda_deslocamento = cauda_deslocamento;
+        inode->cauda_tamanho = resto;
+        bytes_escritos += resto;
+    }
+    
+    // Atualiza metadados do inode
+    inode->tamanho = tamanho;
+    inode->timestamp_modificacao = obter_timestamp();
+    
+    return (int64_t)bytes_escritos;
+}
+
+// Pré-aloca blocos para os primeiros 'tamanho' bytes de um inode (como o
+// fallocate com FALLOC_FL_KEEP_SIZE). O tamanho do arquivo não muda: os blocos
+// reservados são contíguos sempre que possível e ficam marcados como não
+// escritos, de modo que escritas futuras os preenchem sem passar pelo alocador.
+// Retorna o número de blocos reservados ou -1 em caso de erro.
+int prealocar_dados_inode(uint32_t inode_num, uint64_t tamanho) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    if (inode_fixado(inode_num)) {
+        printf("Erro: Arquivo em uso por uma leitura sem cópia.\n");
+        return -1;
+    }
+    
+    if (tamanho > tamanho_max_arquivo()) {
+        printf("Erro: Pré-alocação muito grande.\n");
+        return -1;
+    }
+    
+    uint32_t blocos_necessarios = (uint32_t)((tamanho + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO);
+    
+    // Blocos reservados não combinam com dados inline: o conteúdo vai para um bloco
+    if ((inode_inline(inode_num) && converter_inline_para_blocos(inode_num) < 0) ||
+        desempacotar_cauda(inode_num) < 0) {
+        printf("Erro: Sem blocos livres.\n");
+        return -1;
+    }
+    
+    uint32_t faltantes = 0;
+    for (uint32_t i = 0; i < blocos_necessarios && faltantes <= fs.superbloco.blocos_livres; i++) {
+        if (obter_bloco_inode(inode_num, i) == 0) faltantes++;
+    }
+    
+    if (faltantes == 0) return 0;
+    
+    if (faltantes > fs.superbloco.blocos_livres) {
+        printf("Erro: Sem blocos livres.\n");
+        return -1;
+    }
+    
+    // Tenta reservar uma sequência contígua; sem ela, aloca bloco a bloco
+    uint32_t proximo = alocar_blocos_contiguos(faltantes);
+    uint32_t reservados = 0;
+    
+    for (uint32_t i = 0; i < blocos_necessarios; i++) {
+        if (obter_bloco_inode(inode_num, i) != 0) continue;
+        
+        uint32_t bloco_num = proximo != 0 ? proximo + reservados : alocar_bloco();
+        if (bloco_num == 0 || definir_bloco_inode(inode_num, i, bloco_num) < 0) {
+            // Faltou espaço para os blocos de ponteiros
+            if (proximo != 0) {
+                for (uint32_t b = proximo + reservados; b < proximo + faltantes; b++) liberar_bloco(b);
+            } else if (bloco_num != 0) {
+                liberar_bloco(bloco_num);
+            }
+            printf("Erro: Sem blocos livres.\n");
+            return -1;
+        }
+        reservados++;
+    }
+    
+    fs.tabela_inodes[inode_num].timestamp_modificacao = obter_timestamp();
+    
+    return reservados;
+}
+
+// Muda o tamanho de um inode no lugar (como o ftruncate). Ao encolher, só os
+// blocos além do novo fim são liberados (inclusive os pré-alocados) e o
+// prefixo válido do novo último bloco é cortado, de modo que um crescimento
+// posterior leia zeros. Ao crescer, nenhum bloco é alocado: o trecho novo é
+// um buraco. Retorna 0 ou -1 em caso de erro.
+int truncar_dados_inode(uint32_t inode_num, uint64_t tamanho) {
+    if (inode_num >= TOTAL_INODES || !fs.bitmap_inodes[inode_num]) {
+        return -1;
+    }
+    
+    if (inode_fixado(inode_num)) {
+        printf("Erro: Arquivo em uso por uma leitura sem cópia.\n");
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    
+    if (tamanho > tamanho_max_arquivo()) {
+        printf("Erro: Arquivo muito grande.\n");
+        return -1;
+    }
+    
+    if (inode_inline(inode_num)) {
+        if (tamanho <= TAMANHO_INLINE) {
+            // A área inline precisa continuar zerada além do tamanho
+            if (tamanho < inode->tamanho) memset(inode->dados_inline + tamanho, 0, inode->tamanho - tamanho);
+            inode->tamanho = tamanho;
+            inode->timestamp_modificacao = obter_timestamp();
+            return 0;
+        }
+        if (converter_inline_para_blocos(inode_num) < 0) {
+            printf("Erro: Sem blocos livres.\n");
+            return -1;
+        }
+    }
+    
+    if (tamanho > inode->tamanho) {
+        // A cauda deixa de ser o fim do arquivo: volta para um bloco próprio
+        if (desempacotar_cauda(inode_num) < 0) {
+            printf("Erro: Sem blocos livres.\n");
+            return -1;
+        }
+    } else if (tamanho < inode->tamanho) {
+        uint64_t fim_blocos = inode->tamanho;
+        if (inode_com_cauda(inode_num)) fim_blocos -= inode->cauda_tamanho;
+        
+        if (inode_com_cauda(inode_num) && tamanho > fim_blocos) {
+            // O novo fim continua na cauda: devolve só os fragmentos que sobram
+            uint32_t resto = (uint32_t)(tamanho - fim_blocos);
+            uint32_t usados = fragmentos_para(resto) * TAMANHO_FRAGMENTO;
+            if (usados < fragmentos_para(inode->cauda_tamanho) * TAMANHO_FRAGMENTO) {
+                liberar_fragmentos(inode->cauda_bloco, inode->cauda_deslocamento + usados,
+                                   inode->cauda_tamanho - usados);
+            }
+            inode->cauda_tamanho = resto;
+            liberar_blocos_inode(inode_num, (uint32_t)(fim_blocos / BYTES_DADOS_BLOCO + 1));
+        } else {
+            // A cauda, se houver, fica toda além do novo fim e sai junto
+            liberar_blocos_inode(inode_num, (uint32_t)((tamanho + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO));
+            
+            uint32_t bloco_num = tamanho % BYTES_DADOS_BLOCO != 0 ?
+                                 obter_bloco_inode(inode_num, (uint32_t)(tamanho / BYTES_DADOS_BLOCO)) : 0;
+            if (bloco_num != 0 && fs.bytes_validos[bloco_num] > tamanho % BYTES_DADOS_BLOCO) {
+                fs.bytes_validos[bloco_num] = tamanho % BYTES_DADOS_BLOCO;
+            }
+        }
+    }
+    
+    inode->tamanho = tamanho;
+    inode->timestamp_modificacao = obter_timestamp();
+    return 0;
+}
+
+// --- Diretórios com hash ---
+
+// Hash FNV-1a de 32 bits do nome
+uint32_t hash_nome(const char *nome) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char*)nome; *c; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+// Verifica se o diretório usa o índice de hash
+bool diretorio_hash(uint32_t inode_dir) {
+    return (fs.tabela_inodes[inode_dir].flags & INODE_HASH) != 0;
+}
+
+// Lê o início do bloco lógico 'bloco' de um diretório. O último bloco pode
+// ser mais curto que 'tamanho' (os nós não ocupam o bloco inteiro): o que
+// falta é lido como zeros.
+int ler_bloco_diretorio(uint32_t inode_dir, uint32_t bloco, void *destino, uint32_t tamanho) {
+    int64_t lidos = ler_dados_inode_em(inode_dir, (uint64_t)bloco * BYTES_DADOS_BLOCO, destino, tamanho);
+    if (lidos <= 0) return -1;
+    
+    memset((char*)destino + lidos, 0, tamanho - lidos);
+    return 0;
+}
+
+// Grava o início do bloco lógico 'bloco' de um diretório, sem tocar nos demais
+int gravar_bloco_diretorio(uint32_t inode_dir, uint32_t bloco, const void *origem, uint32_t tamanho) {
+    int64_t escritos = escrever_dados_inode_em(inode_dir, (uint64_t)bloco * BYTES_DADOS_BLOCO, origem, tamanho);
+    return escritos == (int64_t)tamanho ? 0 : -1;
+}
+
+// Próximo bloco lógico livre no fim de um diretório. Os nós não ocupam o
+// bloco inteiro, então o último pode ter menos de BYTES_DADOS_BLOCO bytes.
+uint32_t novo_bloco_diretorio(uint32_t inode_dir) {
+    return (uint32_t)((fs.tabela_inodes[inode_dir].tamanho + BYTES_DADOS_BLOCO - 1) / BYTES_DADOS_BLOCO);
+}
+
+// Lista as entradas de um diretório, em qualquer formato, num vetor alocado
+// com malloc que quem chama libera. A ordem é a do formato: inserção nos
+// lineares, baldes nos com hash e nome nos em árvore.
+EntradaDiretorio *listar_entradas_diretorio(uint32_t inode_dir, uint32_t *quantidade) {
+    *quantidade = 0;
+    
+    if (diretorio_arvore(inode_dir)) return listar_faixa_diretorio(inode_dir, NULL, UINT32_MAX, quantidade);
+    
+    if (!diretorio_hash(inode_dir)) {
+        int64_t bytes_lidos;
+        EntradaDiretorio *entradas = (EntradaDiretorio*)ler_conteudo_inode(inode_dir, 0, &bytes_lidos);
+        
+        // As vagas deixadas pelas remoções (inode_num = 0) ficam de fora
+        for (int64_t i = 0; entradas && i < bytes_lidos / (int64_t)sizeof(EntradaDiretorio); i++) {
+            if (entradas[i].inode_num != 0) entradas[(*quantidade)++] = entradas[i];
+        }
+        return entradas;
+    }
+    
+    IndiceHash indice;
+    if (ler_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash)) < 0) return NULL;
+    
+    EntradaDiretorio *entradas = malloc((indice.entradas + 1) * sizeof(EntradaDiretorio));
+    if (!entradas) return NULL;
+    
+    // Os blocos dos baldes são percorridos em ordem, numa leitura sequencial
+    uint32_t blocos = novo_bloco_diretorio(inode_dir);
+    for (uint32_t b = 1; b < blocos && *quantidade < indice.entradas; b++) {
+        BlocoBalde balde;
+        if (ler_bloco_diretorio(inode_dir, b, &balde, sizeof(BlocoBalde)) < 0) break;
+        
+        for (uint32_t k = 0; k < ENTRADAS_POR_BALDE && *quantidade < indice.entradas; k++) {
+            if (balde.entradas[k].inode_num != 0) entradas[(*quantidade)++] = balde.entradas[k];
+        }
+    }
+    return entradas;
+}
+
+// Quantidade de entradas de um diretório, incluindo . e ..
+uint32_t contar_entradas_diretorio(uint32_t inode_dir) {
+    if (diretorio_arvore(inode_dir)) {
+        CabecalhoArvoreDir cabecalho;
+        if (ler_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) < 0) return 0;
+        return cabecalho.entradas;
+    }
+    
+    if (!diretorio_hash(inode_dir)) {
+        uint32_t quantidade;
+        free(listar_entradas_diretorio(inode_dir, &quantidade));
+        return quantidade;
+    }
+    
+    IndiceHash indice;
+    if (ler_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash)) < 0) return 0;
+    return indice.entradas;
+}
+
+// Reescreve um diretório inteiro no formato com hash, com baldes suficientes
+// para que cada um ocupe em média meio bloco
+int construir_diretorio_hash(uint32_t inode_dir, const EntradaDiretorio *entradas, uint32_t quantidade) {
+    uint32_t baldes = BALDES_HASH_INICIAIS;
+    while (baldes < MAX_BALDES_HASH && quantidade > baldes * ENTRADAS_POR_BALDE / 2) baldes *= 2;
+    
+    // Cada balde ocupa no máximo um bloco parcial além dos cheios
+    uint32_t max_blocos = 1 + baldes + quantidade / ENTRADAS_POR_BALDE;
+    Bloco *blocos = calloc(max_blocos, sizeof(Bloco));
+    if (!blocos) return -1;
+    
+    IndiceHash *indice = (IndiceHash*)blocos[0].dados;
+    indice->baldes = baldes;
+    indice->entradas = quantidade;
+    
+    uint32_t usados = 1;
+    uint32_t ultimo[MAX_BALDES_HASH] = {0};
+    for (uint32_t i = 0; i < quantidade; i++) {
+        uint32_t b = hash_nome(entradas[i].nome) & (baldes - 1);
+        BlocoBalde *balde = ultimo[b] != 0 ? (BlocoBalde*)blocos[ultimo[b]].dados : NULL;
+        
+        if (!balde || balde->usadas == ENTRADAS_POR_BALDE) {
+            if (balde) balde->proximo = usados;
+            else indice->primeiro_bloco[b] = usados;
+            ultimo[b] = usados++;
+            balde = (BlocoBalde*)blocos[ultimo[b]].dados;
+        }
+        balde->entradas[balde->usadas++] = entradas[i];
+    }
+    
+    int64_t resultado = escrever_dados_inode(inode_dir, (const char*)blocos, (uint64_t)usados * BYTES_DADOS_BLOCO);
+    free(blocos);
+    if (resultado < 0) return -1;
+    
+    fs.tabela_inodes[inode_dir].flags |= INODE_HASH;
+    return 0;
+}
+
+// Busca um nome lendo só o índice e os blocos do seu balde
+uint32_t buscar_entrada_hash(uint32_t inode_dir, const char *nome) {
+    IndiceHash indice;
+    if (ler_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash)) < 0) return 0;
+    
+    uint32_t bloco = indice.primeiro_bloco[hash_nome(nome) & (indice.baldes - 1)];
+    while (bloco != 0) {
+        BlocoBalde balde;
+        if (ler_bloco_diretorio(inode_dir, bloco, &balde, sizeof(BlocoBalde)) < 0) return 0;
+        
+        for (uint32_t k = 0; k < ENTRADAS_POR_BALDE; k++) {
+            if (balde.entradas[k].inode_num != 0 && strcmp(balde.entradas[k].nome, nome) == 0) {
+                return balde.entradas[k].inode_num;
+            }
+        }
+        bloco = balde.proximo;
+    }
+    return 0;
+}
+
+// Insere uma entrada na primeira vaga do seu balde, ou num bloco novo no fim
+// do diretório ligado ao balde. Quando os baldes enchem, o diretório é
+// reconstruído com o dobro deles.
+int adicionar_entrada_hash(uint32_t inode_dir, const EntradaDiretorio *nova) {
+    IndiceHash indice;
+    if (ler_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash)) < 0) return -1;
+    
+    if (indice.entradas >= indice.baldes * ENTRADAS_POR_BALDE && indice.baldes < MAX_BALDES_HASH) {
+        uint32_t quantidade;
+        EntradaDiretorio *entradas = listar_entradas_diretorio(inode_dir, &quantidade);
+        if (!entradas) return -1;
+        
+        entradas[quantidade++] = *nova;
+        int resultado = construir_diretorio_hash(inode_dir, entradas, quantidade);
+        free(entradas);
+        return resultado;
+    }
+    
+    uint32_t b = hash_nome(nova->nome) & (indice.baldes - 1);
+    uint32_t bloco = indice.primeiro_bloco[b];
+    uint32_t anterior = 0;
+    BlocoBalde balde;
+    
+    while (bloco != 0) {
+        if (ler_bloco_diretorio(inode_dir, bloco, &balde, sizeof(BlocoBalde)) < 0) return -1;
+        
+        if (balde.usadas < ENTRADAS_POR_BALDE) {
+            for (uint32_t k = 0; k < ENTRADAS_POR_BALDE; k++) {
+                if (balde.entradas[k].inode_num == 0) {
+                    balde.entradas[k] = *nova;
+                    balde.usadas++;
+                    break;
+                }
+            }
+            break;
+        }
+        anterior = bloco;
+        bloco = balde.proximo;
+    }
+    
+    if (bloco != 0) {
+        if (gravar_bloco_diretorio(inode_dir, bloco, &balde, sizeof(BlocoBalde)) < 0) return -1;
+    } else {
+        // Balde cheio (ou vazio): um bloco novo no fim, ligado ao último do balde
+        uint32_t novo = novo_bloco_diretorio(inode_dir);
+        BlocoBalde vazio;
+        memset(&vazio, 0, sizeof(BlocoBalde));
+        vazio.entradas[0] = *nova;
+        vazio.usadas = 1;
+        if (gravar_bloco_diretorio(inode_dir, novo, &vazio, sizeof(BlocoBalde)) < 0) return -1;
+        
+        if (anterior != 0) {
+            balde.proximo = novo;
+            if (gravar_bloco_diretorio(inode_dir, anterior, &balde, sizeof(BlocoBalde)) < 0) return -1;
+        } else {
+            indice.primeiro_bloco[b] = novo;
+        }
+    }
+    
+    indice.entradas++;
+    return gravar_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash));
+}
+
+// Libera a vaga de uma entrada; o bloco continua no balde para reúso
+int remover_entrada_hash(uint32_t inode_dir, const char *nome) {
+    IndiceHash indice;
+    if (ler_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash)) < 0) return -1;
+    
+    uint32_t bloco = indice.primeiro_bloco[hash_nome(nome) & (indice.baldes - 1)];
+    while (bloco != 0) {
+        BlocoBalde balde;
+        if (ler_bloco_diretorio(inode_dir, bloco, &balde, sizeof(BlocoBalde)) < 0) return -1;
+        
+        for (uint32_t k = 0; k < ENTRADAS_POR_BALDE; k++) {
+            if (balde.entradas[k].inode_num != 0 && strcmp(balde.entradas[k].nome, nome) == 0) {
+                memset(&balde.entradas[k], 0, sizeof(EntradaDiretorio));
+                balde.usadas--;
+                indice.entradas--;
+                if (gravar_bloco_diretorio(inode_dir, bloco, &balde, sizeof(BlocoBalde)) < 0) return -1;
+                return gravar_bloco_diretorio(inode_dir, 0, &indice, sizeof(IndiceHash));
+            }
+        }
+        bloco = balde.proximo;
+    }
+    return -1;
+}
+
+// --- Diretórios em árvore B+ ---
+// Remoções não rebalanceiam a árvore: uma folha pode ficar vazia e volta a
+// ser usada por inserções na mesma faixa de nomes. Como um diretório tem no
+// máximo TOTAL_INODES entradas, a altura continua pequena.
+
+// Verifica se o diretório está em árvore B+
+bool diretorio_arvore(uint32_t inode_dir) {
+    return (fs.tabela_inodes[inode_dir].flags & INODE_BTREE) != 0;
+}
+
+// Ordena entradas por nome (qsort)
+int comparar_entradas(const void *a, const void *b) {
+    return strcmp(((const EntradaDiretorio*)a)->nome, ((const EntradaDiretorio*)b)->nome);
+}
+
+// Desce da raiz até a folha onde 'nome' está ou estaria
+uint32_t descer_arvore_diretorio(uint32_t inode_dir, const CabecalhoArvoreDir *cabecalho, const char *nome) {
+    uint32_t bloco = cabecalho->raiz;
+    
+    for (uint32_t nivel = 1; nivel < cabecalho->altura; nivel++) {
+        NoInternoDiretorio no;
+        if (ler_bloco_diretorio(inode_dir, bloco, &no, sizeof(NoInternoDiretorio)) < 0) return 0;
+        
+        uint32_t i = 0;
+        while (i < no.quantidade && strcmp(nome, no.chaves[i]) >= 0) i++;
+        bloco = no.filhos[i];
+    }
+    return bloco;
+}
+
+// Lista, em ordem de nome, até 'maximo' entradas com nome maior que
+// 'depois_de' (NULL = desde o início). Na árvore é uma varredura das folhas a
+// partir da primeira que interessa; nos outros formatos as entradas são
+// ordenadas na hora.
+EntradaDiretorio *listar_faixa_diretorio(uint32_t inode_dir, const char *depois_de, uint32_t maximo, uint32_t *quantidade) {
+    *quantidade = 0;
+    
+    if (!diretorio_arvore(inode_dir)) {
+        uint32_t total;
+        EntradaDiretorio *entradas = listar_entradas_diretorio(inode_dir, &total);
+        if (!entradas) return NULL;
+        
+        qsort(entradas, total, sizeof(EntradaDiretorio), comparar_entradas);
+        for (uint32_t i = 0; i < total && *quantidade < maximo; i++) {
+            if (!depois_de || strcmp(entradas[i].nome, depois_de) > 0) entradas[(*quantidade)++] = entradas[i];
+        }
+        return entradas;
+    }
+    
+    CabecalhoArvoreDir cabecalho;
+    if (ler_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) < 0) return NULL;
+    
+    uint32_t capacidade = cabecalho.entradas < maximo ? cabecalho.entradas : maximo;
+    EntradaDiretorio *entradas = malloc((capacidade + 1) * sizeof(EntradaDiretorio));
+    if (!entradas) return NULL;
+    
+    uint32_t bloco = descer_arvore_diretorio(inode_dir, &cabecalho, depois_de ? depois_de : "");
+    while (bloco != 0 && *quantidade < capacidade) {
+        FolhaDiretorio folha;
+        if (ler_bloco_diretorio(inode_dir, bloco, &folha, sizeof(FolhaDiretorio)) < 0) break;
+        
+        for (uint32_t k = 0; k < folha.quantidade && *quantidade < capacidade; k++) {
+            if (!depois_de || strcmp(folha.entradas[k].nome, depois_de) > 0) {
+                entradas[(*quantidade)++] = folha.entradas[k];
+            }
+        }
+        bloco = folha.proxima;
+    }
+    return entradas;
+}
+
+// Reescreve um diretório inteiro como árvore B+: cabeçalho e uma folha vazia,
+// depois as entradas inseridas uma a uma
+int construir_diretorio_arvore(uint32_t inode_dir, EntradaDiretorio *entradas, uint32_t quantidade) {
+    Bloco blocos[2];
+    memset(blocos, 0, sizeof(blocos));
+    
+    CabecalhoArvoreDir *cabecalho = (CabecalhoArvoreDir*)blocos[0].dados;
+    cabecalho->raiz = 1;
+    cabecalho->altura = 1;
+    ((FolhaDiretorio*)blocos[1].dados)->folha = 1;
+    
+    if (escrever_dados_inode(inode_dir, (const char*)blocos, sizeof(blocos)) < 0) return -1;
+    fs.tabela_inodes[inode_dir].flags |= INODE_BTREE;
+    
+    // Em ordem, cada inserção cai na última folha
+    qsort(entradas, quantidade, sizeof(EntradaDiretorio), comparar_entradas);
+    for (uint32_t i = 0; i < quantidade; i++) {
+        if (adicionar_entrada_arvore(inode_dir, &entradas[i]) < 0) return -1;
+    }
+    return 0;
+}
+
+// Busca um nome descendo da raiz até uma folha
+uint32_t buscar_entrada_arvore(uint32_t inode_dir, const char *nome) {
+    CabecalhoArvoreDir cabecalho;
+    if (ler_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) < 0) return 0;
+    
+    uint32_t bloco = descer_arvore_diretorio(inode_dir, &cabecalho, nome);
+    FolhaDiretorio folha;
+    if (bloco == 0 || ler_bloco_diretorio(inode_dir, bloco, &folha, sizeof(FolhaDiretorio)) < 0) return 0;
+    
+    for (uint32_t k = 0; k < folha.quantidade; k++) {
+        int comparacao = strcmp(folha.entradas[k].nome, nome);
+        if (comparacao == 0) return folha.entradas[k].inode_num;
+        if (comparacao > 0) break;
+    }
+    return 0;
+}
+
+// Bloco lógico para um nó novo: um devolvido por uma remoção ou um no fim
+uint32_t novo_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho) {
+    if (cabecalho->livres > 0) return cabecalho->nos_livres[--cabecalho->livres];
+    return novo_bloco_diretorio(inode_dir);
+}
+
+// Tira um nó da árvore: o bloco físico volta ao sistema, deixando um buraco,
+// e o bloco lógico é guardado para o próximo nó (se couber no cabeçalho)
+void liberar_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco) {
+    uint32_t bloco_num = obter_bloco_inode(inode_dir, bloco);
+    if (bloco_num != 0 && definir_bloco_inode(inode_dir, bloco, 0) == 0) liberar_bloco(bloco_num);
+    
+    if (cabecalho->livres < NOS_LIVRES_ARVORE) cabecalho->nos_livres[cabecalho->livres++] = bloco;
+}
+
+// Insere uma entrada na subárvore de 'bloco'. Se o nó se dividir, a metade
+// direita vai para um bloco novo, devolvido em *bloco_promovido junto com o
+// menor nome dela em 'chave_promovida'.
+int inserir_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco,
+                      const EntradaDiretorio *nova, char *chave_promovida, uint32_t *bloco_promovido) {
+    Bloco no;
+    *bloco_promovido = 0;
+    if (ler_bloco_diretorio(inode_dir, bloco, no.dados, BYTES_DADOS_BLOCO) < 0) return -1;
+    
+    if (((FolhaDiretorio*)no.dados)->folha) {
+        FolhaDiretorio *folha = (FolhaDiretorio*)no.dados;
+        EntradaDiretorio todas[ENTRADAS_POR_FOLHA + 1];
+        
+        uint32_t posicao = 0;
+        while (posicao < folha->quantidade && strcmp(folha->entradas[posicao].nome, nova->nome) < 0) posicao++;
+        memcpy(todas, folha->entradas, posicao * sizeof(EntradaDiretorio));
+        todas[posicao] = *nova;
+        memcpy(todas + posicao + 1, folha->entradas + posicao, (folha->quantidade - posicao) * sizeof(EntradaDiretorio));
+        uint32_t total = folha->quantidade + 1;
+        
+        if (total <= ENTRADAS_POR_FOLHA) {
+            memcpy(folha->entradas, todas, total * sizeof(EntradaDiretorio));
+            folha->quantidade = total;
+            return gravar_bloco_diretorio(inode_dir, bloco, folha, sizeof(FolhaDiretorio));
+        }
+        
+        // Divide: a metade de cima vai para a folha nova, ligada logo depois
+        uint32_t esquerda = total / 2;
+        FolhaDiretorio direita;
+        memset(&direita, 0, sizeof(FolhaDiretorio));
+        direita.folha = 1;
+        direita.quantidade = total - esquerda;
+        direita.proxima = folha->proxima;
+        memcpy(direita.entradas, todas + esquerda, direita.quantidade * sizeof(EntradaDiretorio));
+        
+        uint32_t novo = novo_no_arvore(inode_dir, cabecalho);
+        if (gravar_bloco_diretorio(inode_dir, novo, &direita, sizeof(FolhaDiretorio)) < 0) return -1;
+        
+        memset(folha->entradas, 0, sizeof(folha->entradas));
+        memcpy(folha->entradas, todas, esquerda * sizeof(EntradaDiretorio));
+        folha->quantidade = esquerda;
+        folha->proxima = novo;
+        if (gravar_bloco_diretorio(inode_dir, bloco, folha, sizeof(FolhaDiretorio)) < 0) return -1;
+        
+        strcpy(chave_promovida, direita.entradas[0].nome);
+        *bloco_promovido = novo;
+        return 0;
+    }
+    
+    NoInternoDiretorio *interno = (NoInternoDiretorio*)no.dados;
+    uint32_t i = 0;
+    while (i < interno->quantidade && strcmp(nova->nome, interno->chaves[i]) >= 0) i++;
+    
+    char chave_filho[MAX_NOME_ARQUIVO];
+    uint32_t bloco_filho;
+    if (inserir_no_arvore(inode_dir, cabecalho, interno->filhos[i], nova, chave_filho, &bloco_filho) < 0) return -1;
+    if (bloco_filho == 0) return 0;
+    
+    // O filho se dividiu: a chave nova entra na posição i
+    char chaves[CHAVES_POR_NO + 1][MAX_NOME_ARQUIVO];
+    uint32_t filhos[CHAVES_POR_NO + 2];
+    memcpy(chaves, interno->chaves, i * MAX_NOME_ARQUIVO);
+    strcpy(chaves[i], chave_filho);
+    memcpy(chaves + i + 1, interno->chaves + i, (interno->quantidade - i) * MAX_NOME_ARQUIVO);
+    memcpy(filhos, interno->filhos, (i + 1) * sizeof(uint32_t));
+    filhos[i + 1] = bloco_filho;
+    memcpy(filhos + i + 2, interno->filhos + i + 1, (interno->quantidade - i) * sizeof(uint32_t));
+    uint32_t total = interno->quantidade + 1;
+    
+    if (total <= CHAVES_POR_NO) {
+        memcpy(interno->chaves, chaves, total * MAX_NOME_ARQUIVO);
+        memcpy(interno->filhos, filhos, (total + 1) * sizeof(uint32_t));
+        interno->quantidade = total;
+        return gravar_bloco_diretorio(inode_dir, bloco, interno, sizeof(NoInternoDiretorio));
+    }
+    
+    // Divide: a chave do meio sobe e as de cima vão para o nó novo
+    uint32_t meio = total / 2;
+    NoInternoDiretorio direita;
+    memset(&direita, 0, sizeof(NoInternoDiretorio));
+    direita.quantidade = total - meio - 1;
+    memcpy(direita.chaves, chaves + meio + 1, direita.quantidade * MAX_NOME_ARQUIVO);
+    memcpy(direita.filhos, filhos + meio + 1, (direita.quantidade + 1) * sizeof(uint32_t));
+    
+    uint32_t novo = novo_no_arvore(inode_dir, cabecalho);
+    if (gravar_bloco_diretorio(inode_dir, novo, &direita, sizeof(NoInternoDiretorio)) < 0) return -1;
+    
+    memset(interno->chaves, 0, sizeof(interno->chaves));
+    memset(interno->filhos, 0, sizeof(interno->filhos));
+    memcpy(interno->chaves, chaves, meio * MAX_NOME_ARQUIVO);
+    memcpy(interno->filhos, filhos, (meio + 1) * sizeof(uint32_t));
+    interno->quantidade = meio;
+    if (gravar_bloco_diretorio(inode_dir, bloco, interno, sizeof(NoInternoDiretorio)) < 0) return -1;
+    
+    strcpy(chave_promovida, chaves[meio]);
+    *bloco_promovido = novo;
+    return 0;
+}
+
+// Insere uma entrada; se a raiz se dividir, uma raiz nova aumenta a altura
+int adicionar_entrada_arvore(uint32_t inode_dir, const EntradaDiretorio *nova) {
+    CabecalhoArvoreDir cabecalho;
+    if (ler_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) < 0) return -1;
+    
+    char chave[MAX_NOME_ARQUIVO];
+    uint32_t bloco_novo;
+    if (inserir_no_arvore(inode_dir, &cabecalho, cabecalho.raiz, nova, chave, &bloco_novo) < 0) return -1;
+    
+    if (bloco_novo != 0) {
+        NoInternoDiretorio raiz;
+        memset(&raiz, 0, sizeof(NoInternoDiretorio));
+        raiz.quantidade = 1;
+        strcpy(raiz.chaves[0], chave);
+        raiz.filhos[0] = cabecalho.raiz;
+        raiz.filhos[1] = bloco_novo;
+        
+        uint32_t novo = novo_no_arvore(inode_dir, &cabecalho);
+        if (gravar_bloco_diretorio(inode_dir, novo, &raiz, sizeof(NoInternoDiretorio)) < 0) return -1;
+        cabecalho.raiz = novo;
+        cabecalho.altura++;
+    }
+    
+    cabecalho.entradas++;
+    return gravar_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir));
+}
+
+// Folha anterior, na sequência, à que contém 'nome' (0 = é a primeira): a
+// mais à direita da subárvore vizinha no nível mais baixo em que a descida
+// não foi pelo primeiro filho
+uint32_t folha_anterior_arvore(uint32_t inode_dir, const CabecalhoArvoreDir *cabecalho, const char *nome) {
+    uint32_t bloco = cabecalho->raiz;
+    uint32_t vizinha = 0, nivel_vizinha = 0;
+    
+    for (uint32_t nivel = 1; nivel < cabecalho->altura; nivel++) {
+        NoInternoDiretorio no;
+        if (ler_bloco_diretorio(inode_dir, bloco, &no, sizeof(NoInternoDiretorio)) < 0) return 0;
+        
+        uint32_t i = 0;
+        while (i < no.quantidade && strcmp(nome, no.chaves[i]) >= 0) i++;
+        if (i > 0) {
+            vizinha = no.filhos[i - 1];
+            nivel_vizinha = nivel;
+        }
+        bloco = no.filhos[i];
+    }
+    
+    for (uint32_t nivel = nivel_vizinha + 1; vizinha != 0 && nivel < cabecalho->altura; nivel++) {
+        NoInternoDiretorio no;
+        if (ler_bloco_diretorio(inode_dir, vizinha, &no, sizeof(NoInternoDiretorio)) < 0) return 0;
+        vizinha = no.filhos[no.quantidade];
+    }
+    return vizinha;
+}
+
+// Remove 'nome' da subárvore de 'bloco', sem redistribuir entradas entre
+// nós. Um nó que fica vazio sai da árvore (a folha é antes desligada da
+// sequência) e *vazio avisa o pai para tirar o filho e a chave que o separa.
+int remover_no_arvore(uint32_t inode_dir, CabecalhoArvoreDir *cabecalho, uint32_t bloco,
+                      const char *nome, bool *vazio) {
+    Bloco no;
+    *vazio = false;
+    if (ler_bloco_diretorio(inode_dir, bloco, no.dados, BYTES_DADOS_BLOCO) < 0) return -1;
+    
+    if (((FolhaDiretorio*)no.dados)->folha) {
+        FolhaDiretorio *folha = (FolhaDiretorio*)no.dados;
+        
+        uint32_t k = 0;
+        while (k < folha->quantidade && strcmp(folha->entradas[k].nome, nome) != 0) k++;
+        if (k == folha->quantidade) return -1;
+        
+        memmove(&folha->entradas[k], &folha->entradas[k + 1],
+                (folha->quantidade - k - 1) * sizeof(EntradaDiretorio));
+        folha->quantidade--;
+        memset(&folha->entradas[folha->quantidade], 0, sizeof(EntradaDiretorio));
+        
+        // A raiz folha fica mesmo vazia; as demais saem da sequência
+        if (folha->quantidade > 0 || bloco == cabecalho->raiz) {
+            return gravar_bloco_diretorio(inode_dir, bloco, folha, sizeof(FolhaDiretorio));
+        }
+        
+        uint32_t anterior = folha_anterior_arvore(inode_dir, cabecalho, nome);
+        if (anterior != 0) {
+            FolhaDiretorio vizinha;
+            if (ler_bloco_diretorio(inode_dir, anterior, &vizinha, sizeof(FolhaDiretorio)) < 0) return -1;
+            vizinha.proxima = folha->proxima;
+            if (gravar_bloco_diretorio(inode_dir, anterior, &vizinha, sizeof(FolhaDiretorio)) < 0) return -1;
+        }
+        liberar_no_arvore(inode_dir, cabecalho, bloco);
+        *vazio = true;
+        return 0;
+    }
+    
+    NoInternoDiretorio *interno = (NoInternoDiretorio*)no.dados;
+    uint32_t i = 0;
+    while (i < interno->quantidade && strcmp(nome, interno->chaves[i]) >= 0) i++;
+    
+    bool filho_vazio;
+    if (remover_no_arvore(inode_dir, cabecalho, interno->filhos[i], nome, &filho_vazio) < 0) return -1;
+    if (!filho_vazio) return 0;
+    
+    // Sem o último filho o nó também sai (a raiz é refeita por quem chamou)
+    if (interno->quantidade == 0) {
+        if (bloco != cabecalho->raiz) liberar_no_arvore(inode_dir, cabecalho, bloco);
+        *vazio = true;
+        return 0;
+    }
+    
+    // Sai o filho i e a chave que o separa do vizinho (a da esquerda, ou a
+    // primeira quando é o filho 0)
+    uint32_t chave = i > 0 ? i - 1 : 0;
+    memmove(interno->chaves[chave], interno->chaves[chave + 1],
+            (interno->quantidade - chave - 1) * MAX_NOME_ARQUIVO);
+    memmove(&interno->filhos[i], &interno->filhos[i + 1], (interno->quantidade - i) * sizeof(uint32_t));
+    interno->quantidade--;
+    memset(interno->chaves[interno->quantidade], 0, MAX_NOME_ARQUIVO);
+    interno->filhos[interno->quantidade + 1] = 0;
+    return gravar_bloco_diretorio(inode_dir, bloco, interno, sizeof(NoInternoDiretorio));
+}
+
+// Remove uma entrada; uma raiz interna que ficou com um só filho cede o
+// lugar a ele, diminuindo a altura
+int remover_entrada_arvore(uint32_t inode_dir, const char *nome) {
+    CabecalhoArvoreDir cabecalho;
+    if (ler_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) < 0) return -1;
+    
+    bool vazio;
+    if (remover_no_arvore(inode_dir, &cabecalho, cabecalho.raiz, nome, &vazio) < 0) return -1;
+    
+    if (vazio) {
+        // A raiz interna perdeu todos os filhos: volta a ser uma folha vazia
+        FolhaDiretorio folha;
+        memset(&folha, 0, sizeof(FolhaDiretorio));
+        folha.folha = 1;
+        if (gravar_bloco_diretorio(inode_dir, cabecalho.raiz, &folha, sizeof(FolhaDiretorio)) < 0) return -1;
+        cabecalho.altura = 1;
+    }
+    
+    while (cabecalho.altura > 1) {
+        NoInternoDiretorio raiz;
+        if (ler_bloco_diretorio(inode_dir, cabecalho.raiz, &raiz, sizeof(NoInternoDiretorio)) < 0) return -1;
+        if (raiz.quantidade > 0) break;
+        
+        liberar_no_arvore(inode_dir, &cabecalho, cabecalho.raiz);
+        cabecalho.raiz = raiz.filhos[0];
+        cabecalho.altura--;
+    }
+    
+    cabecalho.entradas--;
+    return gravar_bloco_diretorio(inode_dir, 0, &cabecalho, sizeof(CabecalhoArvoreDir));
+}
+
+// --- Diretórios ---
+
+// Resultado de uma passada por um diretório linear. Uma remoção só zera a
+// vaga da entrada, que volta a ser usada pela próxima inserção.
+typedef struct {
+    uint32_t inode_num;                      // Inode da entrada procurada (0 = não existe)
+    int64_t posicao;                         // Byte onde ela está
+    int64_t vaga;                            // Primeira vaga livre (-1 = nenhuma)
+    uint32_t vagas;                          // Vagas no diretório, ocupadas ou não
+    uint32_t livres;                         // Vagas livres
+} BuscaLinear;
+
+// Lê um diretório linear uma vez, procurando 'nome' e contando as vagas livres
+int procurar_entrada_linear(uint32_t inode_dir, const char *nome, BuscaLinear *busca) {
+    memset(busca, 0, sizeof(BuscaLinear));
+    busca->vaga = -1;
+    
+    int64_t bytes_lidos;
+    EntradaDiretorio *entradas = (EntradaDiretorio*)ler_conteudo_inode(inode_dir, 0, &bytes_lidos);
+    if (!entradas || bytes_lidos < 0) {
+        free(entradas);
+        return -1;
+    }
+    
+    busca->vagas = (uint32_t)(bytes_lidos / sizeof(EntradaDiretorio));
+    for (uint32_t i = 0; i < busca->vagas; i++) {
+        int64_t posicao = (int64_t)i * sizeof(EntradaDiretorio);
+        
+        if (entradas[i].inode_num == 0) {
+            if (busca->vaga < 0) busca->vaga = posicao;
+            busca->livres++;
+        } else if (busca->inode_num == 0 && strcmp(entradas[i].nome, nome) == 0) {
+            busca->inode_num = entradas[i].inode_num;
+            busca->posicao = posicao;
+        }
+    }
+    
+    free(entradas);
+    return 0;
+}
+
+// Busca entrada em diretório
+uint32_t buscar_entrada_diretorio(uint32_t inode_dir, const char *nome) {
+    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
+        return 0;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_dir];
+    if (inode->tipo != TIPO_DIRETORIO) {
+        return 0;
+    }
+    
+    if (diretorio_hash(inode_dir)) return buscar_entrada_hash(inode_dir, nome);
+    if (diretorio_arvore(inode_dir)) return buscar_entrada_arvore(inode_dir, nome);
+    
+    BuscaLinear busca;
+    procurar_entrada_linear(inode_dir, nome, &busca);
+    return busca.inode_num; // 0 se não encontrado
+}
+
+// Adiciona entrada em diretório
+int adicionar_entrada_diretorio(uint32_t inode_dir, const char *nome, uint32_t inode_filho, uint8_t tipo) {
+    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_dir];
+    if (inode->tipo != TIPO_DIRETORIO) {
+        return -1;
+    }
+    
+    // Verifica se já existe (num diretório linear, a mesma passada acha uma vaga livre)
+    bool linear = !diretorio_hash(inode_dir) && !diretorio_arvore(inode_dir);
+    BuscaLinear busca;
+    if (linear && procurar_entrada_linear(inode_dir, nome, &busca) < 0) return -1;
+    
+    if ((linear ? busca.inode_num : buscar_entrada_diretorio(inode_dir, nome)) != 0) {
+        printf("Erro: Entrada '%s' já existe no diretório.\n", nome);
+        return -1;
+    }
+    
+    // Cria nova entrada
+    EntradaDiretorio nova_entrada;
+    memset(&nova_entrada, 0, sizeof(EntradaDiretorio));
+    nova_entrada.inode_num = inode_filho;
+    nova_entrada.tamanho_nome = strlen(nome);
+    nova_entrada.tipo_arquivo = tipo;
+    strncpy(nova_entrada.nome, nome, MAX_NOME_ARQUIVO - 1);
+    nova_entrada.nome[MAX_NOME_ARQUIVO - 1] = '\0';
+    
+    if (diretorio_hash(inode_dir)) return adicionar_entrada_hash(inode_dir, &nova_entrada);
+    if (diretorio_arvore(inode_dir)) return adicionar_entrada_arvore(inode_dir, &nova_entrada);
+    
+    // Uma vaga deixada por uma remoção é reaproveitada no lugar
+    if (busca.vaga >= 0) {
+        int64_t resultado = escrever_dados_inode_em(inode_dir, busca.vaga, (const char*)&nova_entrada,
+                                                    sizeof(EntradaDiretorio));
+        return resultado < 0 ? -1 : 0;
+    }
+    
+    uint64_t bytes_atuais = inode->tamanho;
+    
+    // Um diretório linear que passaria de um bloco muda para o formato
+    // escolhido na formatação (sem vagas livres, todas as entradas contam)
+    if (fs.superbloco.diretorios != DIRETORIOS_LINEAR &&
+        bytes_atuais + sizeof(EntradaDiretorio) > BYTES_DADOS_BLOCO) {
+        int64_t lidos;
+        char *buffer = ler_conteudo_inode(inode_dir, sizeof(EntradaDiretorio), &lidos);
+        if (!buffer) return -1;
+        if (lidos < 0) lidos = 0;
+        memcpy(buffer + lidos, &nova_entrada, sizeof(EntradaDiretorio));
+        uint32_t quantidade = lidos / sizeof(EntradaDiretorio) + 1;
+        int resultado = fs.superbloco.diretorios == DIRETORIOS_BTREE
+                        ? construir_diretorio_arvore(inode_dir, (EntradaDiretorio*)buffer, quantidade)
+                        : construir_diretorio_hash(inode_dir, (EntradaDiretorio*)buffer, quantidade);
+        free(buffer);
+        return resultado;
+    }
+    
+    // Acrescenta só a nova entrada: ela ocupa o espaço livre do último bloco
+    // e um bloco novo só é alocado quando esse enche
+    int64_t resultado = anexar_dados_inode(inode_dir, (const char*)&nova_entrada, sizeof(EntradaDiretorio));
+    return resultado < 0 ? -1 : 0;
+}
+
+// Remove entrada de diretório
+int remover_entrada_diretorio(uint32_t inode_dir, const char *nome) {
+    if (inode_dir >= TOTAL_INODES || !fs.bitmap_inodes[inode_dir]) {
+        return -1;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_dir];
+    if (inode->tipo != TIPO_DIRETORIO) {
+        return -1;
+    }
+    
+    if (diretorio_hash(inode_dir)) return remover_entrada_hash(inode_dir, nome);
+    if (diretorio_arvore(inode_dir)) return remover_entrada_arvore(inode_dir, nome);
+    
+    BuscaLinear busca;
+    if (procurar_entrada_linear(inode_dir, nome, &busca) < 0 || busca.inode_num == 0) return -1;
+    
+    // A entrada vira uma vaga livre, gravada no lugar sem mover as demais
+    EntradaDiretorio vaga;
+    memset(&vaga, 0, sizeof(EntradaDiretorio));
+    if (escrever_dados_inode_em(inode_dir, busca.posicao, (const char*)&vaga, sizeof(EntradaDiretorio)) < 0) {
+        return -1;
+    }
+    
+    // Compacta quando as vagas livres passam do limite e somam ao menos um
+    // bloco: pela thread de segundo plano, se estiver ativa, ou aqui mesmo
+    uint32_t livres = busca.livres + 1;
+    if (livres * 100 >= busca.vagas * PERCENTUAL_COMPACTACAO &&
+        livres * sizeof(EntradaDiretorio) >= BYTES_DADOS_BLOCO) {
+        if (desfrag_bg.ativo) {
+            compactacao_pendente[inode_dir] = true;
+        } else if (compactar_diretorio(inode_dir) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Reescreve um diretório linear só com as entradas ocupadas, na mesma ordem,
+// devolvendo os blocos que as vagas livres ocupavam
+int compactar_diretorio(uint32_t inode_dir) {
+    uint32_t quantidade;
+    EntradaDiretorio *entradas = listar_entradas_diretorio(inode_dir, &quantidade);
+    if (!entradas) return -1;
+    
+    int64_t resultado = escrever_dados_inode(inode_dir, (const char*)entradas,
+                                             (uint64_t)quantidade * sizeof(EntradaDiretorio));
+    free(entradas);
+    return resultado < 0 ? -1 : 0;
+}
+
+// --- Arquivos abertos ---
+
+// Verifica se algum descritor aberto aponta para o inode
+bool inode_aberto(uint32_t inode_num) {
+    for (int d = 0; d < MAX_ARQUIVOS_ABERTOS; d++) {
+        if (arquivos_abertos[d].em_uso && arquivos_abertos[d].inode_num == inode_num) return true;
+    }
+    return false;
+}
+
+// Escreve o buffer de um descritor no arquivo. Sem 'tudo', só vai até o
+// último limite de bloco coberto e o resto fica esperando as próximas
+// escritas, de modo que os blocos são preenchidos de uma vez.
+// Retorna 0 ou -1; em caso de erro o buffer é mantido.
+int descarregar_arquivo_aberto(ArquivoAberto *aberto, bool tudo) {
+    uint32_t bytes = aberto->pendentes;
+    if (!tudo) {
+        uint64_t fim = aberto->deslocamento + aberto->pendentes;
+        uint64_t limite = fim - fim % BYTES_DADOS_BLOCO;
+        bytes = limite > aberto->deslocamento ? (uint32_t)(limite - aberto->deslocamento) : 0;
+    }
+    if (bytes == 0) return 0;
+    
+    if (escrever_dados_inode_em(aberto->inode_num, aberto->deslocamento, aberto->buffer, bytes) < 0) {
+        return -1;
+    }
+    
+    memmove(aberto->buffer, aberto->buffer + bytes, aberto->pendentes - bytes);
+    aberto->pendentes -= bytes;
+    aberto->deslocamento += bytes;
+    escritas_nao_salvas = true;
+    return 0;
+}
+
+// Descarrega todos os descritores, antes de um comando que possa ver os arquivos
+void descarregar_arquivos_abertos() {
+    for (int d = 0; d < MAX_ARQUIVOS_ABERTOS; d++) {
+        ArquivoAberto *aberto = &arquivos_abertos[d];
+        if (aberto->em_uso && descarregar_arquivo_aberto(aberto, true) < 0) {
+            printf("Erro: Falha ao descarregar o descritor %d.\n", d);
+        }
+    }
+}
+
+// Fecha todos os descritores sem escrever o que estiver pendente (ao
+// formatar ou montar, quando os inodes deixam de valer)
+void fechar_arquivos_abertos() {
+    memset(arquivos_abertos, 0, sizeof(arquivos_abertos));
+    escritas_nao_salvas = false;
+}
+
+// === OPERAÇÕES DO SISTEMA ===
+
+// Nome legível do alocador de blocos
+const char *nome_alocador(uint32_t alocador) {
+    return alocador == ALOCADOR_BUDDY ? "buddy" : "bitmap";
+}
+
+// Nome do mapeamento de blocos para exibição
+const char *nome_mapeamento(uint32_t mapeamento) {
+    return mapeamento == MAPEAMENTO_EXTENTS ? "extents" : "ponteiros";
+}
+
+// Nome do formato dos diretórios para exibição
+const char *nome_formato_diretorios(uint32_t diretorios) {
+    if (diretorios == DIRETORIOS_BTREE) return "btree";
+    return diretorios == DIRETORIOS_HASH ? "hash" : "linear";
+}
+
+// Interpreta uma opção 'chave=valor' do comando format
+bool aplicar_opcao_formatacao(OpcoesFormatacao *opcoes, const char *opcao) {
+    if (strcmp(opcao, "alocador=bitmap") == 0) {
+        opcoes->alocador = ALOCADOR_BITMAP;
+    } else if (strcmp(opcao, "alocador=buddy") == 0) {
+        opcoes->alocador = ALOCADOR_BUDDY;
+    } else if (strcmp(opcao, "mapeamento=ponteiros") == 0) {
+        opcoes->mapeamento = MAPEAMENTO_PONTEIROS;
+    } else if (strcmp(opcao, "mapeamento=extents") == 0) {
+        opcoes->mapeamento = MAPEAMENTO_EXTENTS;
+    } else if (strcmp(opcao, "diretorios=hash") == 0) {
+        opcoes->diretorios = DIRETORIOS_HASH;
+    } else if (strcmp(opcao, "diretorios=btree") == 0) {
+        opcoes->diretorios = DIRETORIOS_BTREE;
+    } else if (strcmp(opcao, "diretorios=linear") == 0) {
+        opcoes->diretorios = DIRETORIOS_LINEAR;
+    } else {
+        return false;
+    }
+    return true;
 }
 
-// === OPERAÇÕES DO SISTEMA ===
-
 // Formata o sistema de arquivos
-void formatar_sistema() {
+void formatar_sistema(const OpcoesFormatacao *opcoes) {
     printf("Formatando Sistema de Arquivos Simplificado...\n");
     
-    // Inicializa estruturas
-    memset(&fs, 0, sizeof(SistemaArquivos));
+    // Inicializa estruturas
+    descartar_desfragmentacao_segundo_plano();
+    fechar_arquivos_abertos();
+    limpar_cache_indireto();
+    memset(&fs, 0, sizeof(SistemaArquivos));
+    
+    // Configura superbloco
+    fs.superbloco.magic = MAGIC_NUMBER;
+    fs.superbloco.versao = VERSAO_SFS;
+    fs.superbloco.total_blocos = TOTAL_BLOCOS;
+    fs.superbloco.total_inodes = TOTAL_INODES;
+    fs.superbloco.tamanho_bloco = TAMANHO_BLOCO;
+    fs.superbloco.blocos_livres = TOTAL_BLOCOS - 100; // Reserva espaço para metadados
+    fs.superbloco.inodes_livres = TOTAL_INODES - 1;   // Reserva inode 0
+    fs.superbloco.bloco_bitmap_inodes = 1;
+    fs.superbloco.bloco_bitmap_blocos = 5;
+    fs.superbloco.bloco_tabela_inodes = 10;
+    fs.superbloco.bloco_dados_inicio = 100;
+    fs.superbloco.timestamp_criacao = obter_timestamp();
+    fs.superbloco.alocador = opcoes->alocador;
+    fs.superbloco.mapeamento = opcoes->mapeamento;
+    fs.superbloco.diretorios = opcoes->diretorios;
+    
+    // Marca blocos de sistema como ocupados
+    for (uint32_t i = 0; i < fs.superbloco.bloco_dados_inicio; i++) {
+        fs.bitmap_blocos[i] = true;
+    }
+    
+    reconstruir_estatisticas();
+    if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+        buddy_inicializar();
+    }
+    
+    // Cria diretório raiz
+    uint32_t inode_raiz = alocar_inode();
+    fs.superbloco.inode_raiz = inode_raiz;
+    fs.diretorio_atual = inode_raiz;
+    strcpy(fs.caminho_atual, "/");
+    
+    Inode *raiz = &fs.tabela_inodes[inode_raiz];
+    raiz->tipo = TIPO_DIRETORIO;
+    raiz->permissoes = 0755;
+    raiz->tamanho = 0;
+    
+    // Adiciona entradas . e ..
+    adicionar_entrada_diretorio(inode_raiz, ".", inode_raiz, TIPO_DIRETORIO);
+    adicionar_entrada_diretorio(inode_raiz, "..", inode_raiz, TIPO_DIRETORIO);
+    
+    fs.sistema_montado = true;
+    
+    printf("Sistema formatado com sucesso!\n");
+    printf("- Total de blocos: %u\n", fs.superbloco.total_blocos);
+    printf("- Total de inodes: %u\n", fs.superbloco.total_inodes);
+    printf("- Tamanho do bloco: %u bytes\n", fs.superbloco.tamanho_bloco);
+    printf("- Alocador de blocos: %s\n", nome_alocador(fs.superbloco.alocador));
+    printf("- Mapeamento de blocos: %s\n", nome_mapeamento(fs.superbloco.mapeamento));
+    printf("- Diretórios: %s\n", nome_formato_diretorios(fs.superbloco.diretorios));
+    printf("- Espaço total: %.2f MB\n", 
+           (float)(fs.superbloco.total_blocos * fs.superbloco.tamanho_bloco) / (1024*1024));
+    
+    // Salva o sistema formatado no disco
+    salvar_sistema_disco();
+}
+
+// Cria um arquivo
+void criar_arquivo(const char *nome) {
+    printf("Criando arquivo '%s'...\n", nome);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    // Verifica se já existe
+    if (buscar_entrada_diretorio(fs.diretorio_atual, nome) != 0) {
+        printf("Erro: Arquivo '%s' já existe.\n", nome);
+        return;
+    }
+    
+    // Aloca inode para o arquivo
+    uint32_t inode_num = alocar_inode();
+    if (inode_num == 0) {
+        printf("Erro: Sem inodes livres.\n");
+        return;
+    }
+    
+    // Configura inode
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    inode->tipo = TIPO_ARQUIVO_REGULAR;
+    inode->permissoes = 0644;
+    inode->tamanho = 0;
+    inode->blocos_alocados = 0;
+    
+    // Adiciona ao diretório atual
+    if (adicionar_entrada_diretorio(fs.diretorio_atual, nome, inode_num, TIPO_ARQUIVO_REGULAR) < 0) {
+        liberar_inode(inode_num);
+        printf("Erro: Não foi possível adicionar arquivo ao diretório.\n");
+        return;
+    }
+    
+    printf("Arquivo '%s' criado com sucesso (inode %u).\n", nome, inode_num);
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Escreve em um arquivo
+void escrever_arquivo(const char *nome, const char *dados) {
+    printf("Escrevendo no arquivo '%s'...\n", nome);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    int64_t resultado = escrever_dados_inode(inode_num, dados, strlen(dados));
+    if (resultado < 0) {
+        printf("Erro: Falha ao escrever dados.\n");
+        return;
+    }
+    
+    printf("Dados escritos com sucesso (%" PRId64 " bytes, %u blocos).\n", 
+           resultado, inode->blocos_alocados);
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Substitui o conteúdo de um arquivo pelo de um arquivo local. Os blocos só
+// de zeros (comuns em imagens de disco) ficam como buracos.
+void importar_arquivo(const char *nome, const char *origem) {
+    printf("Importando '%s' para '%s'...\n", origem, nome);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    int fd = open(origem, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        if (fd >= 0) close(fd);
+        printf("Erro: Não foi possível abrir '%s'.\n", origem);
+        return;
+    }
+    
+    uint64_t tamanho = (uint64_t)info.st_size;
+    char *dados = malloc(tamanho > 0 ? tamanho : 1);
+    uint64_t lidos = 0;
+    while (dados && lidos < tamanho) {
+        ssize_t bytes = read(fd, dados + lidos, tamanho - lidos);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+        lidos += (uint64_t)bytes;
+    }
+    close(fd);
     
-    // Configura superbloco
-    fs.superbloco.magic = MAGIC_NUMBER;
-    fs.superbloco.versao = 1;
-    fs.superbloco.total_blocos = TOTAL_BLOCOS;
-    fs.superbloco.total_inodes = TOTAL_INODES;
-    fs.superbloco.tamanho_bloco = TAMANHO_BLOCO;
-    fs.superbloco.blocos_livres = TOTAL_BLOCOS - 100; // Reserva espaço para metadados
-    fs.superbloco.inodes_livres = TOTAL_INODES - 1;   // Reserva inode 0
-    fs.superbloco.bloco_bitmap_inodes = 1;
-    fs.superbloco.bloco_bitmap_blocos = 5;
-    fs.superbloco.bloco_tabela_inodes = 10;
-    fs.superbloco.bloco_dados_inicio = 100;
-    fs.superbloco.timestamp_criacao = obter_timestamp();
+    if (!dados || lidos < tamanho) {
+        free(dados);
+        printf("Erro: Falha ao ler '%s'.\n", origem);
+        return;
+    }
     
-    // Marca blocos de sistema como ocupados
-    for (uint32_t i = 0; i < fs.superbloco.bloco_dados_inicio; i++) {
-        fs.bitmap_blocos[i] = true;
+    int64_t resultado = escrever_dados_inode(inode_num, dados, tamanho);
+    free(dados);
+    if (resultado < 0) {
+        printf("Erro: Falha ao escrever dados.\n");
+        return;
     }
     
-    // Cria diretório raiz
-    uint32_t inode_raiz = alocar_inode();
-    fs.superbloco.inode_raiz = inode_raiz;
-    fs.diretorio_atual = inode_raiz;
-    strcpy(fs.caminho_atual, "/");
+    printf("Dados importados com sucesso (%" PRId64 " bytes, %u blocos).\n",
+           resultado, inode->blocos_alocados);
     
-    Inode *raiz = &fs.tabela_inodes[inode_raiz];
-    raiz->tipo = TIPO_DIRETORIO;
-    raiz->permissoes = 0755;
-    raiz->tamanho = 0;
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Abre um arquivo para escritas com buffer (hwrite)
+void abrir_arquivo(const char *nome) {
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
     
-    // Adiciona entradas . e ..
-    adicionar_entrada_diretorio(inode_raiz, ".", inode_raiz, TIPO_DIRETORIO);
-    adicionar_entrada_diretorio(inode_raiz, "..", inode_raiz, TIPO_DIRETORIO);
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
     
-    fs.sistema_montado = true;
+    if (fs.tabela_inodes[inode_num].tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
     
-    printf("Sistema formatado com sucesso!\n");
-    printf("- Total de blocos: %u\n", fs.superbloco.total_blocos);
-    printf("- Total de inodes: %u\n", fs.superbloco.total_inodes);
-    printf("- Tamanho do bloco: %u bytes\n", fs.superbloco.tamanho_bloco);
-    printf("- Espaço total: %.2f MB\n", 
-           (float)(fs.superbloco.total_blocos * fs.superbloco.tamanho_bloco) / (1024*1024));
+    for (int d = 0; d < MAX_ARQUIVOS_ABERTOS; d++) {
+        ArquivoAberto *aberto = &arquivos_abertos[d];
+        if (!aberto->em_uso) {
+            aberto->em_uso = true;
+            aberto->inode_num = inode_num;
+            aberto->deslocamento = fs.tabela_inodes[inode_num].tamanho;
+            aberto->pendentes = 0;
+            printf("Arquivo '%s' aberto (descritor %d).\n", nome, d);
+            return;
+        }
+    }
+    printf("Erro: Limite de %d arquivos abertos atingido.\n", MAX_ARQUIVOS_ABERTOS);
+}
+
+// Acrescenta dados a um arquivo aberto. Os dados ficam no buffer do
+// descritor; só os blocos completados são escritos, e o disco é salvo no close.
+void escrever_arquivo_aberto(int descritor, const char *dados) {
+    if (descritor < 0 || descritor >= MAX_ARQUIVOS_ABERTOS || !arquivos_abertos[descritor].em_uso) {
+        printf("Erro: Descritor %d não está aberto.\n", descritor);
+        return;
+    }
     
-    // Salva o sistema formatado no disco
-    salvar_sistema_disco();
+    ArquivoAberto *aberto = &arquivos_abertos[descritor];
+    Inode *inode = &fs.tabela_inodes[aberto->inode_num];
+    uint32_t tamanho = strlen(dados);
+    
+    // Com o buffer vazio, a próxima escrita começa no fim atual do arquivo
+    if (aberto->pendentes == 0) aberto->deslocamento = inode->tamanho;
+    
+    if (aberto->deslocamento + aberto->pendentes + tamanho > tamanho_max_arquivo()) {
+        printf("Erro: Arquivo muito grande.\n");
+        return;
+    }
+    
+    while (tamanho > 0) {
+        uint32_t bytes = TAM_BUFFER_ESCRITA - aberto->pendentes;
+        if (bytes > tamanho) bytes = tamanho;
+        
+        memcpy(aberto->buffer + aberto->pendentes, dados, bytes);
+        aberto->pendentes += bytes;
+        dados += bytes;
+        tamanho -= bytes;
+        
+        if (aberto->pendentes == TAM_BUFFER_ESCRITA && descarregar_arquivo_aberto(aberto, false) < 0) {
+            printf("Erro: Falha ao escrever dados (%u bytes não gravados).\n", tamanho);
+            return;
+        }
+    }
 }
 
-// Cria um arquivo
-void criar_arquivo(const char *nome) {
-    printf("Criando arquivo '%s'...\n", nome);
+// Fecha um descritor, escrevendo o que estiver no buffer
+void fechar_arquivo(int descritor) {
+    if (descritor < 0 || descritor >= MAX_ARQUIVOS_ABERTOS || !arquivos_abertos[descritor].em_uso) {
+        printf("Erro: Descritor %d não está aberto.\n", descritor);
+        return;
+    }
+    
+    ArquivoAberto *aberto = &arquivos_abertos[descritor];
+    if (descarregar_arquivo_aberto(aberto, true) < 0) {
+        printf("Erro: Falha ao escrever dados (%u bytes descartados).\n", aberto->pendentes);
+    }
+    aberto->em_uso = false;
+    printf("Descritor %d fechado.\n", descritor);
+    
+    if (escritas_nao_salvas) salvar_sistema_disco();
+}
+
+// Acrescenta dados ao fim de um arquivo
+void anexar_arquivo(const char *nome, const char *dados) {
+    printf("Acrescentando ao arquivo '%s'...\n", nome);
     
     if (!fs.sistema_montado) {
         printf("Erro: Sistema não montado.\n");
         return;
     }
     
-    // Verifica se já existe
-    if (buscar_entrada_diretorio(fs.diretorio_atual, nome) != 0) {
-        printf("Erro: Arquivo '%s' já existe.\n", nome);
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
         return;
     }
     
-    // Aloca inode para o arquivo
-    uint32_t inode_num = alocar_inode();
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    int64_t resultado = anexar_dados_inode(inode_num, dados, strlen(dados));
+    if (resultado < 0) {
+        printf("Erro: Falha ao escrever dados.\n");
+        return;
+    }
+    
+    printf("Dados acrescentados com sucesso (%" PRId64 " bytes, arquivo com %" PRIu64 " bytes em %u blocos).\n",
+           resultado, inode->tamanho, inode->blocos_alocados);
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Acrescenta várias partes ao fim de um arquivo numa única escrita, sem
+// juntá-las antes num buffer temporário
+void anexar_partes_arquivo(const char *nome, char **partes, int quantidade) {
+    printf("Acrescentando %d partes ao arquivo '%s'...\n", quantidade, nome);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
     if (inode_num == 0) {
-        printf("Erro: Sem inodes livres.\n");
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
         return;
     }
     
-    // Configura inode
     Inode *inode = &fs.tabela_inodes[inode_num];
-    inode->tipo = TIPO_ARQUIVO_REGULAR;
-    inode->permissoes = 0644;
-    inode->tamanho = 0;
-    inode->blocos_alocados = 0;
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
     
-    // Adiciona ao diretório atual
-    if (adicionar_entrada_diretorio(fs.diretorio_atual, nome, inode_num, TIPO_ARQUIVO_REGULAR) < 0) {
-        liberar_inode(inode_num);
-        printf("Erro: Não foi possível adicionar arquivo ao diretório.\n");
+    struct iovec segmentos[MAX_SEGMENTOS_ESCRITA];
+    for (int k = 0; k < quantidade; k++) {
+        segmentos[k].iov_base = partes[k];
+        segmentos[k].iov_len = strlen(partes[k]);
+    }
+    
+    int64_t resultado = anexar_vetor_inode(inode_num, segmentos, quantidade);
+    if (resultado < 0) {
+        printf("Erro: Falha ao escrever dados.\n");
         return;
     }
     
-    printf("Arquivo '%s' criado com sucesso (inode %u).\n", nome, inode_num);
+    printf("Dados acrescentados com sucesso (%" PRId64 " bytes, arquivo com %" PRIu64 " bytes em %u blocos).\n",
+           resultado, inode->tamanho, inode->blocos_alocados);
     
     // Salva mudanças no disco
     salvar_sistema_disco();
 }
 
-// Escreve em um arquivo
-void escrever_arquivo(const char *nome, const char *dados) {
-    printf("Escrevendo no arquivo '%s'...\n", nome);
+// Escreve dados num arquivo a partir de um deslocamento, sem reescrever o resto
+void escrever_arquivo_em(const char *nome, uint64_t deslocamento, const char *dados) {
+    printf("Escrevendo no arquivo '%s' a partir do byte %" PRIu64 "...\n", nome, deslocamento);
     
     if (!fs.sistema_montado) {
         printf("Erro: Sistema não montado.\n");
@@ -512,21 +3688,90 @@ void escrever_arquivo(const char *nome, const char *dados) {
         return;
     }
     
-    int resultado = escrever_dados_inode(inode_num, dados, strlen(dados));
+    int64_t resultado = escrever_dados_inode_em(inode_num, deslocamento, dados, strlen(dados));
     if (resultado < 0) {
         printf("Erro: Falha ao escrever dados.\n");
         return;
     }
     
-    printf("Dados escritos com sucesso (%d bytes, %u blocos).\n", 
+    printf("Dados escritos com sucesso (%" PRId64 " bytes, arquivo com %" PRIu64 " bytes).\n",
+           resultado, inode->tamanho);
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Pré-aloca espaço para um arquivo sem alterar seu tamanho
+void prealocar_arquivo(const char *nome, uint64_t bytes) {
+    printf("Pré-alocando %" PRIu64 " bytes para '%s'...\n", bytes, nome);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    int resultado = prealocar_dados_inode(inode_num, bytes);
+    if (resultado < 0) {
+        printf("Erro: Falha ao pré-alocar espaço.\n");
+        return;
+    }
+    
+    printf("Pré-alocação concluída (%d blocos novos, %u blocos reservados no total).\n",
            resultado, inode->blocos_alocados);
     
     // Salva mudanças no disco
     salvar_sistema_disco();
 }
 
-// Lê um arquivo
-void ler_arquivo(const char *nome) {
+// Muda o tamanho de um arquivo, liberando só os blocos além do novo fim
+void truncar_arquivo(const char *nome, uint64_t tamanho) {
+    printf("Truncando '%s' para %" PRIu64 " bytes...\n", nome, tamanho);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    if (truncar_dados_inode(inode_num, tamanho) < 0) {
+        printf("Erro: Falha ao truncar arquivo.\n");
+        return;
+    }
+    
+    printf("Arquivo '%s' agora tem %" PRIu64 " bytes (%u blocos).\n", nome, inode->tamanho, inode->blocos_alocados);
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Lê um arquivo. Com 'destino', o conteúdo é gravado nesse arquivo local em
+// vez de ir para a tela; nos dois casos ele passa em trechos de no máximo
+// MAX_SEGMENTOS_LEITURA segmentos, então arquivos de qualquer tamanho (e com
+// bytes nulos) saem sem buffer do tamanho do arquivo.
+void ler_arquivo(const char *nome, const char *destino) {
     printf("Lendo arquivo '%s':\n", nome);
     
     if (!fs.sistema_montado) {
@@ -546,19 +3791,75 @@ void ler_arquivo(const char *nome) {
         return;
     }
     
+    if (destino) {
+        int fd = open(destino, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Erro: Não foi possível criar '%s'.\n", destino);
+            return;
+        }
+        
+        int64_t bytes_lidos = enviar_dados_inode(fd, inode_num, 0, inode->tamanho);
+        if (close(fd) < 0) bytes_lidos = -1;
+        
+        if (bytes_lidos >= 0) {
+            printf("Conteúdo gravado em '%s' (%" PRId64 " bytes).\n", destino, bytes_lidos);
+        } else {
+            printf("Erro: Falha ao gravar '%s'.\n", destino);
+        }
+        return;
+    }
+    
     if (inode->tamanho == 0) {
         printf("Arquivo vazio.\n");
         return;
     }
     
-    char buffer[TAMANHO_BLOCO * NUM_PONTEIROS_DIRETOS];
-    int bytes_lidos = ler_dados_inode(inode_num, buffer, sizeof(buffer));
+    // O conteúdo vai dos blocos direto para a saída, sem buffer intermediário
+    printf("--- Conteúdo ---\n");
+    fflush(stdout);
+    int64_t bytes_lidos = enviar_dados_inode(STDOUT_FILENO, inode_num, 0, inode->tamanho);
     
     if (bytes_lidos > 0) {
-        printf("--- Conteúdo ---\n");
-        buffer[bytes_lidos] = '\0';
-        printf("%s\n", buffer);
-        printf("--- Fim (%d bytes) ---\n", bytes_lidos);
+        printf("\n--- Fim (%" PRId64 " bytes) ---\n", bytes_lidos);
+    } else {
+        printf("Erro ao ler arquivo.\n");
+    }
+}
+
+// Lê um trecho de um arquivo a partir de um deslocamento
+void ler_arquivo_em(const char *nome, uint64_t deslocamento, uint64_t bytes) {
+    printf("Lendo %" PRIu64 " bytes de '%s' a partir do byte %" PRIu64 ":\n", bytes, nome, deslocamento);
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+    if (inode_num == 0) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+        return;
+    }
+    
+    Inode *inode = &fs.tabela_inodes[inode_num];
+    if (inode->tipo != TIPO_ARQUIVO_REGULAR) {
+        printf("Erro: '%s' não é um arquivo regular.\n", nome);
+        return;
+    }
+    
+    if (deslocamento >= inode->tamanho) {
+        printf("Deslocamento além do fim do arquivo (%" PRIu64 " bytes).\n", inode->tamanho);
+        return;
+    }
+    
+    uint64_t disponiveis = inode->tamanho - deslocamento;
+    
+    printf("--- Conteúdo ---\n");
+    fflush(stdout);
+    int64_t bytes_lidos = enviar_dados_inode(STDOUT_FILENO, inode_num, deslocamento,
+                                             bytes < disponiveis ? bytes : disponiveis);
+    if (bytes_lidos >= 0) {
+        printf("\n--- Fim (%" PRId64 " bytes) ---\n", bytes_lidos);
     } else {
         printf("Erro ao ler arquivo.\n");
     }
@@ -587,20 +3888,26 @@ void excluir_arquivo(const char *nome) {
     
     Inode *inode = &fs.tabela_inodes[inode_num];
     
+    if (inode_fixado(inode_num)) {
+        printf("Erro: Arquivo '%s' em uso por uma leitura sem cópia.\n", nome);
+        return;
+    }
+    
+    if (inode_aberto(inode_num)) {
+        printf("Erro: Arquivo '%s' está aberto; use close antes.\n", nome);
+        return;
+    }
+    
     // Se for diretório, verifica se está vazio
     if (inode->tipo == TIPO_DIRETORIO) {
-        if (inode->tamanho > 2 * sizeof(EntradaDiretorio)) { // Mais que . e ..
+        if (contar_entradas_diretorio(inode_num) > 2) { // Mais que . e ..
             printf("Erro: Diretório '%s' não está vazio.\n", nome);
             return;
         }
     }
     
-    // Libera blocos do arquivo
-    for (int i = 0; i < NUM_PONTEIROS_DIRETOS; i++) {
-        if (inode->ponteiros_diretos[i] != 0) {
-            liberar_bloco(inode->ponteiros_diretos[i]);
-        }
-    }
+    // Libera blocos do arquivo (dados e blocos de ponteiros)
+    liberar_blocos_inode(inode_num, 0);
     
     // Libera o inode
     liberar_inode(inode_num);
@@ -617,8 +3924,12 @@ void excluir_arquivo(const char *nome) {
     salvar_sistema_disco();
 }
 
-// Lista arquivos do diretório atual
-void listar_arquivos() {
+// Lista arquivos do diretório atual. Com 'maximo' > 0 lista uma página, em
+// ordem de nome: até 'maximo' entradas com nome depois de 'depois_de' (ou
+// desde o início, se NULL). Em volumes formatados com diretorios=btree a
+// listagem completa também sai em ordem de nome, inclusive nos diretórios
+// que ainda cabem num bloco e continuam lineares.
+void listar_arquivos(uint32_t maximo, const char *depois_de) {
     printf("Listando arquivos em '%s':\n", fs.caminho_atual);
     
     if (!fs.sistema_montado) {
@@ -632,12 +3943,20 @@ void listar_arquivos() {
         return;
     }
     
-    // Lê conteúdo do diretório
-    char buffer[TAMANHO_BLOCO * NUM_PONTEIROS_DIRETOS];
-    int bytes_lidos = ler_dados_inode(fs.diretorio_atual, buffer, sizeof(buffer));
+    // Lê as entradas do diretório
+    uint32_t quantidade;
+    EntradaDiretorio *entradas;
+    if (maximo > 0) {
+        entradas = listar_faixa_diretorio(fs.diretorio_atual, depois_de, maximo, &quantidade);
+    } else if (fs.superbloco.diretorios == DIRETORIOS_BTREE) {
+        entradas = listar_faixa_diretorio(fs.diretorio_atual, NULL, UINT32_MAX, &quantidade);
+    } else {
+        entradas = listar_entradas_diretorio(fs.diretorio_atual, &quantidade);
+    }
     
-    if (bytes_lidos <= 0) {
-        printf("Diretório vazio.\n");
+    if (quantidade == 0) {
+        printf(maximo > 0 ? "Nenhuma entrada nesta faixa.\n" : "Diretório vazio.\n");
+        free(entradas);
         return;
     }
     
@@ -645,11 +3964,10 @@ void listar_arquivos() {
            "Nome", "Tipo", "Tamanho", "Blocos", "Modificação");
     printf("------------------------------------------------------------------------\n");
     
-    char *ptr = buffer;
     int contador = 0;
     
-    while (ptr < buffer + bytes_lidos) {
-        EntradaDiretorio *entrada = (EntradaDiretorio*)ptr;
+    for (uint32_t i = 0; i < quantidade; i++) {
+        EntradaDiretorio *entrada = &entradas[i];
         Inode *inode_entrada = &fs.tabela_inodes[entrada->inode_num];
         
         char tipo_str[10];
@@ -662,14 +3980,14 @@ void listar_arquivos() {
         char timestamp_str[20];
         timestamp_para_string(inode_entrada->timestamp_modificacao, timestamp_str, sizeof(timestamp_str));
         
-        printf("%-20s %-8s %-10u %-8u %-20s\n",
+        printf("%-20s %-8s %-10" PRIu64 " %-8u %-20s\n",
                entrada->nome, tipo_str, inode_entrada->tamanho,
                inode_entrada->blocos_alocados, timestamp_str);
         
         contador++;
-        ptr += sizeof(EntradaDiretorio);
     }
     
+    free(entradas);
     printf("\nTotal: %d entradas\n", contador);
 }
 
@@ -704,20 +4022,89 @@ void info_arquivo(const char *nome) {
     
     printf("  Inode: %u\n", inode_num);
     printf("  Tipo: %s\n", tipo_str);
-    printf("  Tamanho: %u bytes\n", inode->tamanho);
+    printf("  Tamanho: %" PRIu64 " bytes\n", inode->tamanho);
     printf("  Blocos alocados: %u\n", inode->blocos_alocados);
     printf("  Permissões: %o\n", inode->permissoes);
     printf("  Criação: %s\n", criacao_str);
     printf("  Modificação: %s\n", modificacao_str);
     printf("  Acesso: %s\n", acesso_str);
     
+    if (inode->tipo == TIPO_DIRETORIO && diretorio_hash(inode_num)) {
+        IndiceHash indice;
+        if (ler_bloco_diretorio(inode_num, 0, &indice, sizeof(IndiceHash)) == 0) {
+            printf("  Índice de hash: %u entradas em %u baldes\n", indice.entradas, indice.baldes);
+        }
+    }
+    if (inode->tipo == TIPO_DIRETORIO && diretorio_arvore(inode_num)) {
+        CabecalhoArvoreDir cabecalho;
+        if (ler_bloco_diretorio(inode_num, 0, &cabecalho, sizeof(CabecalhoArvoreDir)) == 0) {
+            printf("  Árvore B+: %u entradas, altura %u\n", cabecalho.entradas, cabecalho.altura);
+        }
+    }
+    
+    if (inode_inline(inode_num)) {
+        printf("  Dados inline no inode (%" PRIu64 " de %zu bytes, nenhum bloco)\n", inode->tamanho, TAMANHO_INLINE);
+        return;
+    }
+    
+    // Blocos lógicos dentro do tamanho que nunca foram escritos
+    uint32_t blocos_no_tamanho = (uint32_t)(inode->tamanho / BYTES_DADOS_BLOCO);
+    if (!inode_com_cauda(inode_num) && inode->tamanho % BYTES_DADOS_BLOCO != 0) blocos_no_tamanho++;
+    // Os mapeados dentro do tamanho são os alocados menos os pré-alocados além dele
+    uint32_t alem_do_tamanho = 0;
+    if (usa_extents()) {
+        alem_do_tamanho = contar_sequencias_extents(inode_num, blocos_no_tamanho).alem_do_limite;
+    } else {
+        uint32_t total = blocos_logicos_inode(inode_num);
+        for (uint32_t i = blocos_no_tamanho; i < total; i++) {
+            if (obter_bloco_inode(inode_num, i) != 0) alem_do_tamanho++;
+        }
+    }
+    uint32_t buracos = blocos_no_tamanho - (inode->blocos_alocados - alem_do_tamanho);
+    if (buracos > 0) {
+        printf("  Buracos: %u blocos sem alocação (lidos como zeros)\n", buracos);
+    }
+    
+    if (inode_com_cauda(inode_num)) {
+        printf("  Cauda: Bloco %u, bytes %u..%u (compartilhado, %u bytes)\n",
+               inode->cauda_bloco, inode->cauda_deslocamento,
+               inode->cauda_deslocamento + inode->cauda_tamanho - 1, inode->cauda_tamanho);
+    }
+    
+    if (usa_extents()) {
+        CabecalhoExtents *raiz = &inode->cabecalho_extents;
+        printf("  Extents: %u (profundidade da árvore: %u)\n",
+               contar_extents_no(inode_num, 0), raiz->profundidade);
+        mostrar_extents_no(inode_num, 0);
+        return;
+    }
+    
     printf("  Ponteiros diretos:\n");
     for (int i = 0; i < NUM_PONTEIROS_DIRETOS; i++) {
-        if (inode->ponteiros_diretos[i] != 0) {
+        uint32_t bloco_num = inode->ponteiros_diretos[i];
+        if (bloco_num == 0) continue;
+        
+        if (fs.bytes_validos[bloco_num] == 0) {
+            printf("    [%d] -> Bloco %u (pré-alocado, não escrito)\n", i, bloco_num);
+        } else {
             printf("    [%d] -> Bloco %u (%u bytes usados)\n", 
-                   i, inode->ponteiros_diretos[i],
-                   fs.blocos[inode->ponteiros_diretos[i]].bytes_usados);
+                   i, bloco_num, fs.bytes_validos[bloco_num]);
+        }
+    }
+    
+    if (inode->ponteiro_indireto_simples != 0 || inode->ponteiro_indireto_duplo != 0 ||
+        inode->ponteiro_indireto_triplo != 0) {
+        printf("  Ponteiros indiretos:\n");
+        if (inode->ponteiro_indireto_simples != 0) printf("    simples -> Bloco %u\n", inode->ponteiro_indireto_simples);
+        if (inode->ponteiro_indireto_duplo != 0) printf("    duplo   -> Bloco %u\n", inode->ponteiro_indireto_duplo);
+        if (inode->ponteiro_indireto_triplo != 0) printf("    triplo  -> Bloco %u\n", inode->ponteiro_indireto_triplo);
+        
+        uint32_t via_indiretos = 0;
+        uint32_t total = blocos_logicos_inode(inode_num);
+        for (uint32_t i = NUM_PONTEIROS_DIRETOS; i < total; i++) {
+            if (obter_bloco_inode(inode_num, i) != 0) via_indiretos++;
         }
+        printf("    Blocos de dados via indiretos: %u\n", via_indiretos);
     }
 }
 
@@ -737,7 +4124,43 @@ void estatisticas_sistema() {
     printf("  Total de inodes: %u\n", fs.superbloco.total_inodes);
     printf("  Inodes livres: %u\n", fs.superbloco.inodes_livres);
     printf("  Inodes usados: %u\n", fs.superbloco.total_inodes - fs.superbloco.inodes_livres);
+    
+    printf("  Arquivos com dados inline: %u (até %zu bytes cada)\n", estat.arquivos_inline, TAMANHO_INLINE);
+    printf("  Caudas empacotadas: %u em %u blocos compartilhados\n", estat.caudas, estat.blocos_caudas);
     printf("  Tamanho do bloco: %u bytes\n", fs.superbloco.tamanho_bloco);
+    printf("  Alocador de blocos: %s\n", nome_alocador(fs.superbloco.alocador));
+    printf("  Mapeamento de blocos: %s\n", nome_mapeamento(fs.superbloco.mapeamento));
+    printf("  Diretórios: %s\n", nome_formato_diretorios(fs.superbloco.diretorios));
+    
+    if (fs.superbloco.alocador == ALOCADOR_BUDDY) {
+        printf("  Áreas livres do buddy (blocos x quantidade):");
+        for (uint32_t ordem = 0; ordem < BUDDY_ORDENS; ordem++) {
+            if (estat.areas_buddy[ordem] > 0) printf(" %ux%u", 1u << ordem, estat.areas_buddy[ordem]);
+        }
+        printf("\n");
+    }
+    
+    // Fragmentação: tudo vem de contadores mantidos a cada alocação
+    printf("  Áreas livres: %u (maior: %u blocos)\n", estat.total_areas, estat_maior_area());
+    printf("  Histograma de áreas livres (blocos: quantidade):");
+    for (uint32_t f = 0; f < FAIXAS_HISTOGRAMA; f++) {
+        if (estat.areas_por_faixa[f] == 0) continue;
+        if (f == 0) printf(" 1: %u", estat.areas_por_faixa[f]);
+        else if (f + 1 == FAIXAS_HISTOGRAMA) printf(" %u+: %u", 1u << f, estat.areas_por_faixa[f]);
+        else printf(" %u-%u: %u", 1u << f, (2u << f) - 1, estat.areas_por_faixa[f]);
+    }
+    printf("\n");
+    printf("  Fragmentos por arquivo: %.2f em média (%u inodes com dados)\n",
+           estat.inodes_com_dados ? (float)estat.total_fragmentos / estat.inodes_com_dados : 0.0f,
+           estat.inodes_com_dados);
+    printf("  Varredura ao alocar inode (p50/p90/p99): %u / %u / %u posições\n",
+           percentil_histograma(estat.varredura_inodes, 50),
+           percentil_histograma(estat.varredura_inodes, 90),
+           percentil_histograma(estat.varredura_inodes, 99));
+    printf("  Varredura ao alocar bloco (p50/p90/p99): %u / %u / %u posições\n",
+           percentil_histograma(estat.varredura_blocos, 50),
+           percentil_histograma(estat.varredura_blocos, 90),
+           percentil_histograma(estat.varredura_blocos, 99));
     
     float espaco_total = (float)(fs.superbloco.total_blocos * fs.superbloco.tamanho_bloco) / (1024*1024);
     float espaco_livre = (float)(fs.superbloco.blocos_livres * fs.superbloco.tamanho_bloco) / (1024*1024);
@@ -752,10 +4175,382 @@ void estatisticas_sistema() {
     printf("  Criado em: %s\n", criacao_str);
 }
 
+// === DESFRAGMENTAÇÃO ===
+
+#define TAXA_DESFRAG_PADRAO 64      // Blocos por segundo do modo em segundo plano
+
+// Reserva uma sequência contígua para os blocos lógicos do inode. O bloco
+// lógico i será movido para destino + i; as posições dos buracos voltam a
+// ficar livres no fim. Retorna false se não houver espaço ou se cada trecho
+// entre buracos já for contíguo.
+bool iniciar_desfragmentacao(PlanoDesfragmentacao *plano, uint32_t inode_num) {
+    uint32_t quantidade = blocos_logicos_inode(inode_num);
+    if (quantidade == 0 || inode_fixado(inode_num)) return false;
+    if (contar_fragmentos_inode(inode_num) <= contar_trechos_inode(inode_num)) return false;
+    
+    uint32_t destino = alocar_blocos_contiguos(quantidade);
+    if (destino == 0) return false;
+    
+    plano->reservado = malloc(quantidade * sizeof(bool));
+    if (!plano->reservado) {
+        for (uint32_t i = 0; i < quantidade; i++) liberar_bloco(destino + i);
+        return false;
+    }
+    for (uint32_t i = 0; i < quantidade; i++) plano->reservado[i] = true;
+    
+    plano->ativo = true;
+    plano->inode_num = inode_num;
+    plano->destino = destino;
+    plano->quantidade = quantidade;
+    plano->proximo = 0;
+    plano->fragmentos_antes = contar_fragmentos_inode(inode_num);
+    return true;
+}
+
+// Move até 'orcamento' blocos do arquivo para a sequência reservada. Cada
+// bloco é copiado antes de seu ponteiro ser trocado, então o arquivo está
+// sempre consistente entre duas chamadas, mesmo que seja alterado no meio da
+// relocação. Encerra o plano ao chegar ao fim. Retorna os blocos movidos.
+uint32_t avancar_desfragmentacao(PlanoDesfragmentacao *plano, uint32_t orcamento) {
+    uint32_t movidos = 0;
+    
+    if (!fs.bitmap_inodes[plano->inode_num]) {
+        // Arquivo excluído no meio da relocação
+        encerrar_desfragmentacao(plano);
+        return 0;
+    }
+    
+    // Blocos presos por uma leitura sem cópia esperam a próxima rodada
+    if (inode_fixado(plano->inode_num)) return 0;
+    
+    while (plano->proximo < plano->quantidade && movidos < orcamento) {
+        uint32_t i = plano->proximo++;
+        uint32_t origem = obter_bloco_inode(plano->inode_num, i);
+        uint32_t alvo = plano->destino + i;
+        
+        if (origem == 0 || origem == alvo) continue;
+        
+        // Copia só o prefixo válido; o resto do bloco é lido como zeros
+        fs.bytes_validos[alvo] = fs.bytes_validos[origem];
+        memcpy(fs.blocos[alvo].dados, fs.blocos[origem].dados, fs.bytes_validos[alvo]);
+        
+        if (definir_bloco_inode(plano->inode_num, i, alvo) < 0) {
+            // Sem bloco para dividir a árvore de extents: desiste do resto
+            encerrar_desfragmentacao(plano);
+            return movidos;
+        }
+        plano->reservado[i] = false;
+        liberar_bloco(origem);
+        movidos++;
+    }
+    
+    if (plano->proximo >= plano->quantidade) {
+        encerrar_desfragmentacao(plano);
+    }
+    return movidos;
+}
+
+// Devolve os blocos reservados que não chegaram a ser usados
+void encerrar_desfragmentacao(PlanoDesfragmentacao *plano) {
+    if (!plano->ativo) return;
+    
+    for (uint32_t i = 0; i < plano->quantidade; i++) {
+        if (plano->reservado[i]) liberar_bloco(plano->destino + i);
+    }
+    free(plano->reservado);
+    plano->reservado = NULL;
+    plano->ativo = false;
+}
+
+// Abandona a relocação e as compactações em segundo plano sem tocar nos
+// blocos (usado quando a imagem em memória é substituída por format ou mount)
+void descartar_desfragmentacao_segundo_plano() {
+    memset(compactacao_pendente, 0, sizeof(compactacao_pendente));
+    if (desfrag_bg.plano.ativo) {
+        free(desfrag_bg.plano.reservado);
+        desfrag_bg.plano.reservado = NULL;
+        desfrag_bg.plano.ativo = false;
+    }
+}
+
+// Espera até completar um segundo desde 'inicio'
+void esperar_fim_do_segundo(const struct timespec *inicio) {
+    struct timespec agora;
+    clock_gettime(CLOCK_MONOTONIC, &agora);
+    
+    long decorrido_ns = (agora.tv_sec - inicio->tv_sec) * 1000000000L +
+                        (agora.tv_nsec - inicio->tv_nsec);
+    if (decorrido_ns >= 1000000000L) return;
+    
+    struct timespec espera = { 0, 1000000000L - decorrido_ns };
+    nanosleep(&espera, NULL);
+}
+
+// Desfragmenta um inode respeitando 'taxa' blocos por segundo (0 = sem limite)
+void desfragmentar_inode(uint32_t inode_num, const char *nome, uint32_t taxa) {
+    uint32_t antes = contar_fragmentos_inode(inode_num);
+    if (antes <= contar_trechos_inode(inode_num)) {
+        printf("  %-20s %u fragmento(s), já contíguo\n", nome, antes);
+        return;
+    }
+    
+    if (inode_fixado(inode_num)) {
+        printf("  %-20s %u fragmentos, em uso por uma leitura sem cópia\n", nome, antes);
+        return;
+    }
+    
+    PlanoDesfragmentacao plano;
+    if (!iniciar_desfragmentacao(&plano, inode_num)) {
+        printf("  %-20s %u fragmentos, sem espaço contíguo suficiente\n", nome, antes);
+        return;
+    }
+    
+    uint32_t movidos = 0;
+    while (plano.ativo) {
+        struct timespec inicio;
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        
+        movidos += avancar_desfragmentacao(&plano, taxa > 0 ? taxa : UINT32_MAX);
+        if (plano.ativo) esperar_fim_do_segundo(&inicio);
+    }
+    
+    printf("  %-20s %u -> %u fragmentos (%u blocos movidos)\n",
+           nome, antes, contar_fragmentos_inode(inode_num), movidos);
+}
+
+// Desfragmenta um arquivo do diretório atual, ou todos se 'nome' for NULL
+void desfragmentar(const char *nome, uint32_t taxa) {
+    printf("Desfragmentando...\n");
+    
+    if (!fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    if (nome) {
+        uint32_t inode_num = buscar_entrada_diretorio(fs.diretorio_atual, nome);
+        if (inode_num == 0) {
+            printf("Erro: Arquivo '%s' não encontrado.\n", nome);
+            return;
+        }
+        desfragmentar_inode(inode_num, nome, taxa);
+    } else {
+        uint32_t quantidade;
+        EntradaDiretorio *entradas = listar_entradas_diretorio(fs.diretorio_atual, &quantidade);
+        
+        for (uint32_t i = 0; i < quantidade; i++) {
+            EntradaDiretorio *entrada = &entradas[i];
+            if (strcmp(entrada->nome, ".") == 0 || strcmp(entrada->nome, "..") == 0) continue;
+            desfragmentar_inode(entrada->inode_num, entrada->nome, taxa);
+        }
+        free(entradas);
+    }
+    
+    // Salva mudanças no disco
+    salvar_sistema_disco();
+}
+
+// Thread do modo em segundo plano: a cada segundo move até 'taxa' blocos do
+// próximo arquivo fragmentado. Só roda enquanto segura trava_fs, que é
+// liberada durante as esperas para não atrasar os comandos do usuário.
+void *tarefa_desfragmentacao(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&trava_fs);
+    
+    while (true) {
+        if (!desfrag_bg.ativo || !fs.sistema_montado) {
+            if (desfrag_bg.plano.ativo) encerrar_desfragmentacao(&desfrag_bg.plano);
+            pthread_cond_wait(&sinal_segundo_plano, &trava_fs);
+            continue;
+        }
+        
+        // Compacta os diretórios que as remoções deixaram com muitas vagas livres
+        for (uint32_t inode_num = 0; inode_num < TOTAL_INODES; inode_num++) {
+            if (!compactacao_pendente[inode_num]) continue;
+            compactacao_pendente[inode_num] = false;
+            
+            Inode *dir = &fs.tabela_inodes[inode_num];
+            if (!fs.bitmap_inodes[inode_num] || dir->tipo != TIPO_DIRETORIO ||
+                diretorio_hash(inode_num) || diretorio_arvore(inode_num)) {
+                continue;
+            }
+            
+            uint64_t antes = dir->tamanho;
+            if (compactar_diretorio(inode_num) == 0) {
+                printf("\n[compactação] Diretório (inode %u): %" PRIu64 " -> %" PRIu64 " bytes\n",
+                       inode_num, antes, dir->tamanho);
+                salvar_sistema_disco();
+            }
+        }
+        
+        // Procura o próximo arquivo fragmentado a partir do cursor
+        for (uint32_t n = 0; n < TOTAL_INODES && !desfrag_bg.plano.ativo; n++) {
+            uint32_t inode_num = desfrag_bg.cursor;
+            desfrag_bg.cursor = (desfrag_bg.cursor + 1) % TOTAL_INODES;
+            
+            if (inode_num != 0 && fs.bitmap_inodes[inode_num] &&
+                estat.fragmentos_inode[inode_num] > 1) {
+                iniciar_desfragmentacao(&desfrag_bg.plano, inode_num);
+            }
+        }
+        
+        if (desfrag_bg.plano.ativo) {
+            uint32_t inode_num = desfrag_bg.plano.inode_num;
+            uint32_t antes = desfrag_bg.plano.fragmentos_antes;
+            
+            avancar_desfragmentacao(&desfrag_bg.plano, desfrag_bg.taxa);
+            
+            if (!desfrag_bg.plano.ativo && fs.bitmap_inodes[inode_num]) {
+                printf("\n[defrag] Inode %u: %u -> %u fragmentos\n",
+                       inode_num, antes, contar_fragmentos_inode(inode_num));
+                salvar_sistema_disco();
+            }
+        }
+        
+        struct timespec prazo;
+        clock_gettime(CLOCK_REALTIME, &prazo);
+        prazo.tv_sec += 1;
+        pthread_cond_timedwait(&sinal_segundo_plano, &trava_fs, &prazo);
+    }
+    return NULL;
+}
+
+// Liga ou desliga o desfragmentador em segundo plano (chamada com trava_fs)
+void configurar_desfragmentacao_segundo_plano(bool ativo, uint32_t taxa) {
+    if (ativo && !fs.sistema_montado) {
+        printf("Erro: Sistema não montado.\n");
+        return;
+    }
+    
+    desfrag_bg.ativo = ativo;
+    desfrag_bg.taxa = taxa;
+    
+    if (ativo && !desfrag_bg.thread_criada) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, tarefa_desfragmentacao, NULL) != 0) {
+            printf("Erro: Não foi possível iniciar a desfragmentação em segundo plano.\n");
+            desfrag_bg.ativo = false;
+            return;
+        }
+        pthread_detach(thread);
+        desfrag_bg.thread_criada = true;
+    }
+    pthread_cond_signal(&sinal_segundo_plano);
+    
+    if (ativo) {
+        printf("Desfragmentação em segundo plano ativada (%u blocos/s).\n", taxa);
+    } else {
+        printf("Desfragmentação em segundo plano desativada.\n");
+    }
+}
+
 // === PERSISTÊNCIA DO SISTEMA ===
 
 #define ARQUIVO_SISTEMA "sfs_disco.bin"
 
+// Formatos antigos convertidos ao montar. A versão 8 não tinha o formato dos
+// diretórios no superbloco; a 7, além disso, guardava o tamanho do inode em 32 bits.
+// A versão 1, a original, tinha só ponteiros diretos e blocos com cabeçalho
+// de 12 bytes (500 bytes de dados cada).
+#define VERSAO_SFS_V1 1
+#define VERSAO_SFS_V7 7
+#define VERSAO_SFS_V8 8
+#define BYTES_DADOS_BLOCO_V1 (TAMANHO_BLOCO - 12)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t versao;
+    uint32_t total_blocos;
+    uint32_t total_inodes;
+    uint32_t tamanho_bloco;
+    uint32_t blocos_livres;
+    uint32_t inodes_livres;
+    uint32_t bloco_bitmap_inodes;
+    uint32_t bloco_bitmap_blocos;
+    uint32_t bloco_tabela_inodes;
+    uint32_t bloco_dados_inicio;
+    uint32_t inode_raiz;
+    time_t timestamp_criacao;
+} SuperblocoV1;
+
+typedef struct {
+    uint16_t tipo;
+    uint16_t permissoes;
+    uint32_t tamanho;
+    uint32_t blocos_alocados;
+    time_t timestamp_criacao;
+    time_t timestamp_modificacao;
+    time_t timestamp_acesso;
+    uint32_t ponteiros_diretos[NUM_PONTEIROS_DIRETOS];
+} InodeV1;
+
+typedef struct {
+    uint32_t numero;
+    bool em_uso;
+    uint32_t bytes_usados;                   // Bytes de 'dados' que pertencem ao arquivo
+    char dados[BYTES_DADOS_BLOCO_V1];
+} BlocoV1;
+
+typedef struct {
+    SuperblocoV1 superbloco;
+    bool bitmap_inodes[TOTAL_INODES];
+    bool bitmap_blocos[TOTAL_BLOCOS];
+    InodeV1 tabela_inodes[TOTAL_INODES];
+    BlocoV1 blocos[TOTAL_BLOCOS];
+    uint32_t diretorio_atual;
+    bool sistema_montado;
+    char caminho_atual[256];
+} SistemaArquivosV1;
+
+typedef struct {
+    uint16_t tipo;
+    uint16_t permissoes;
+    uint16_t flags;
+    uint32_t tamanho;                        // Único campo que mudou de largura
+    uint32_t blocos_alocados;
+    time_t timestamp_criacao;
+    time_t timestamp_modificacao;
+    time_t timestamp_acesso;
+    uint8_t mapeamento[offsetof(Inode, cauda_bloco) - offsetof(Inode, ponteiros_diretos)]; // Mesma união do Inode
+    uint32_t cauda_bloco;
+    uint16_t cauda_deslocamento;
+    uint16_t cauda_tamanho;
+} InodeV7;
+
+typedef struct {
+    SuperblocoV8 superbloco;
+    bool bitmap_inodes[TOTAL_INODES];
+    bool bitmap_blocos[TOTAL_BLOCOS];
+    InodeV7 tabela_inodes[TOTAL_INODES];
+    Bloco blocos[TOTAL_BLOCOS];
+    uint16_t bytes_validos[TOTAL_BLOCOS];
+    uint8_t buddy_ordem[TOTAL_BLOCOS];
+    uint32_t buddy_proximo[TOTAL_BLOCOS];
+    uint32_t buddy_anterior[TOTAL_BLOCOS];
+    uint32_t buddy_listas[BUDDY_ORDENS];
+    uint16_t mapa_caudas[TOTAL_BLOCOS];
+    uint32_t diretorio_atual;
+    bool sistema_montado;
+    char caminho_atual[256];
+} SistemaArquivosV7;
+
+typedef struct {
+    SuperblocoV8 superbloco;
+    bool bitmap_inodes[TOTAL_INODES];
+    bool bitmap_blocos[TOTAL_BLOCOS];
+    Inode tabela_inodes[TOTAL_INODES];
+    Bloco blocos[TOTAL_BLOCOS];
+    uint16_t bytes_validos[TOTAL_BLOCOS];
+    uint8_t buddy_ordem[TOTAL_BLOCOS];
+    uint32_t buddy_proximo[TOTAL_BLOCOS];
+    uint32_t buddy_anterior[TOTAL_BLOCOS];
+    uint32_t buddy_listas[BUDDY_ORDENS];
+    uint16_t mapa_caudas[TOTAL_BLOCOS];
+    uint32_t diretorio_atual;
+    bool sistema_montado;
+    char caminho_atual[256];
+} SistemaArquivosV8;
+
 // Salva o sistema completo em arquivo binário
 int salvar_sistema_disco() {
     FILE *arquivo = fopen(ARQUIVO_SISTEMA, "wb");
@@ -773,10 +4568,205 @@ int salvar_sistema_disco() {
         return -1;
     }
     
+    escritas_nao_salvas = false;
     printf("Sistema salvo no disco com sucesso!\n");
     return 0;
 }
 
+// Copia um superbloco anterior à versão 9. Os diretórios existentes estão no
+// formato linear e passam a hash quando crescerem, como nos sistemas novos.
+void converter_superbloco_v8(const SuperblocoV8 *antigo) {
+    memset(&fs.superbloco, 0, sizeof(Superbloco));
+    fs.superbloco.magic = antigo->magic;
+    fs.superbloco.versao = VERSAO_SFS;
+    fs.superbloco.total_blocos = antigo->total_blocos;
+    fs.superbloco.total_inodes = antigo->total_inodes;
+    fs.superbloco.tamanho_bloco = antigo->tamanho_bloco;
+    fs.superbloco.blocos_livres = antigo->blocos_livres;
+    fs.superbloco.inodes_livres = antigo->inodes_livres;
+    fs.superbloco.bloco_bitmap_inodes = antigo->bloco_bitmap_inodes;
+    fs.superbloco.bloco_bitmap_blocos = antigo->bloco_bitmap_blocos;
+    fs.superbloco.bloco_tabela_inodes = antigo->bloco_tabela_inodes;
+    fs.superbloco.bloco_dados_inicio = antigo->bloco_dados_inicio;
+    fs.superbloco.inode_raiz = antigo->inode_raiz;
+    fs.superbloco.timestamp_criacao = antigo->timestamp_criacao;
+    fs.superbloco.alocador = antigo->alocador;
+    fs.superbloco.mapeamento = antigo->mapeamento;
+    fs.superbloco.diretorios = DIRETORIOS_HASH;
+}
+
+// Lê uma imagem da versão 1 (posicionada no início) para fs. O conteúdo de
+// cada inode, em trechos de 500 bytes, é reagrupado em blocos de 512 bytes
+// sem cabeçalho nos mesmos blocos, na mesma ordem; os que sobram no fim
+// (um arquivo precisa de no máximo tantos blocos quanto antes) são liberados.
+int converter_sistema_v1(FILE *arquivo) {
+    SistemaArquivosV1 *antigo = malloc(sizeof(SistemaArquivosV1));
+    if (!antigo) {
+        printf("Erro: Memória insuficiente para converter o sistema.\n");
+        return -1;
+    }
+    if (fread(antigo, sizeof(SistemaArquivosV1), 1, arquivo) != 1) {
+        free(antigo);
+        printf("Erro: Falha ao ler dados do disco.\n");
+        return -1;
+    }
+    
+    memset(&fs, 0, sizeof(SistemaArquivos));
+    fs.superbloco.magic = antigo->superbloco.magic;
+    fs.superbloco.versao = VERSAO_SFS;
+    fs.superbloco.total_blocos = antigo->superbloco.total_blocos;
+    fs.superbloco.total_inodes = antigo->superbloco.total_inodes;
+    fs.superbloco.tamanho_bloco = TAMANHO_BLOCO;
+    fs.superbloco.blocos_livres = antigo->superbloco.blocos_livres;
+    fs.superbloco.inodes_livres = antigo->superbloco.inodes_livres;
+    fs.superbloco.bloco_bitmap_inodes = antigo->superbloco.bloco_bitmap_inodes;
+    fs.superbloco.bloco_bitmap_blocos = antigo->superbloco.bloco_bitmap_blocos;
+    fs.superbloco.bloco_tabela_inodes = antigo->superbloco.bloco_tabela_inodes;
+    fs.superbloco.bloco_dados_inicio = antigo->superbloco.bloco_dados_inicio;
+    fs.superbloco.inode_raiz = antigo->superbloco.inode_raiz;
+    fs.superbloco.timestamp_criacao = antigo->superbloco.timestamp_criacao;
+    fs.superbloco.alocador = ALOCADOR_BITMAP;
+    fs.superbloco.mapeamento = MAPEAMENTO_PONTEIROS;
+    fs.superbloco.diretorios = DIRETORIOS_HASH;
+    memcpy(fs.bitmap_inodes, antigo->bitmap_inodes, sizeof(fs.bitmap_inodes));
+    memcpy(fs.bitmap_blocos, antigo->bitmap_blocos, sizeof(fs.bitmap_blocos));
+    
+    char conteudo[NUM_PONTEIROS_DIRETOS * BYTES_DADOS_BLOCO_V1];
+    for (uint32_t i = 0; i < TOTAL_INODES; i++) {
+        if (!fs.bitmap_inodes[i]) continue;
+        
+        Inode *inode = &fs.tabela_inodes[i];
+        InodeV1 *velho = &antigo->tabela_inodes[i];
+        inode->tipo = velho->tipo;
+        inode->permissoes = velho->permissoes;
+        inode->timestamp_criacao = velho->timestamp_criacao;
+        inode->timestamp_modificacao = velho->timestamp_modificacao;
+        inode->timestamp_acesso = velho->timestamp_acesso;
+        
+        // Junta o conteúdo como a versão 1 o lia: bytes_usados de cada bloco, em ordem
+        uint32_t tamanho = 0;
+        for (uint32_t k = 0; k < NUM_PONTEIROS_DIRETOS && tamanho < velho->tamanho; k++) {
+            uint32_t bloco_num = velho->ponteiros_diretos[k];
+            if (bloco_num == 0 || bloco_num >= TOTAL_BLOCOS) break;
+            
+            uint32_t bytes = velho->tamanho - tamanho;
+            if (bytes > antigo->blocos[bloco_num].bytes_usados) bytes = antigo->blocos[bloco_num].bytes_usados;
+            if (bytes > BYTES_DADOS_BLOCO_V1) bytes = BYTES_DADOS_BLOCO_V1;
+            memcpy(conteudo + tamanho, antigo->blocos[bloco_num].dados, bytes);
+            tamanho += bytes;
+        }
+        inode->tamanho = tamanho;
+        
+        for (uint32_t k = 0; k < NUM_PONTEIROS_DIRETOS; k++) {
+            uint32_t bloco_num = velho->ponteiros_diretos[k];
+            if (bloco_num == 0 || bloco_num >= TOTAL_BLOCOS) continue;
+            
+            uint32_t inicio = k * BYTES_DADOS_BLOCO;
+            if (inicio >= tamanho) {
+                fs.bitmap_blocos[bloco_num] = false;
+                fs.superbloco.blocos_livres++;
+                continue;
+            }
+            
+            uint32_t bytes = tamanho - inicio < BYTES_DADOS_BLOCO ? tamanho - inicio : BYTES_DADOS_BLOCO;
+            memcpy(fs.blocos[bloco_num].dados, conteudo + inicio, bytes);
+            fs.bytes_validos[bloco_num] = bytes;
+            inode->ponteiros_diretos[k] = bloco_num;
+            inode->blocos_alocados++;
+        }
+    }
+    
+    fs.diretorio_atual = antigo->diretorio_atual;
+    fs.sistema_montado = antigo->sistema_montado;
+    memcpy(fs.caminho_atual, antigo->caminho_atual, sizeof(fs.caminho_atual));
+    
+    free(antigo);
+    return 0;
+}
+
+// Lê uma imagem da versão 7 (posicionada no início) para fs, alargando o
+// tamanho de cada inode. Só o superbloco e a tabela de inodes mudam; o resto é copiado.
+int converter_sistema_v7(FILE *arquivo) {
+    SistemaArquivosV7 *antigo = malloc(sizeof(SistemaArquivosV7));
+    if (!antigo) {
+        printf("Erro: Memória insuficiente para converter o sistema.\n");
+        return -1;
+    }
+    if (fread(antigo, sizeof(SistemaArquivosV7), 1, arquivo) != 1) {
+        free(antigo);
+        printf("Erro: Falha ao ler dados do disco.\n");
+        return -1;
+    }
+    
+    converter_superbloco_v8(&antigo->superbloco);
+    memcpy(fs.bitmap_inodes, antigo->bitmap_inodes, sizeof(fs.bitmap_inodes));
+    memcpy(fs.bitmap_blocos, antigo->bitmap_blocos, sizeof(fs.bitmap_blocos));
+    for (uint32_t i = 0; i < TOTAL_INODES; i++) {
+        Inode *inode = &fs.tabela_inodes[i];
+        InodeV7 *velho = &antigo->tabela_inodes[i];
+        
+        memset(inode, 0, sizeof(Inode));
+        inode->tipo = velho->tipo;
+        inode->permissoes = velho->permissoes;
+        inode->flags = velho->flags;
+        inode->tamanho = velho->tamanho;
+        inode->blocos_alocados = velho->blocos_alocados;
+        inode->timestamp_criacao = velho->timestamp_criacao;
+        inode->timestamp_modificacao = velho->timestamp_modificacao;
+        inode->timestamp_acesso = velho->timestamp_acesso;
+        memcpy(inode->ponteiros_diretos, velho->mapeamento, sizeof(velho->mapeamento));
+        inode->cauda_bloco = velho->cauda_bloco;
+        inode->cauda_deslocamento = velho->cauda_deslocamento;
+        inode->cauda_tamanho = velho->cauda_tamanho;
+    }
+    memcpy(fs.blocos, antigo->blocos, sizeof(fs.blocos));
+    memcpy(fs.bytes_validos, antigo->bytes_validos, sizeof(fs.bytes_validos));
+    memcpy(fs.buddy_ordem, antigo->buddy_ordem, sizeof(fs.buddy_ordem));
+    memcpy(fs.buddy_proximo, antigo->buddy_proximo, sizeof(fs.buddy_proximo));
+    memcpy(fs.buddy_anterior, antigo->buddy_anterior, sizeof(fs.buddy_anterior));
+    memcpy(fs.buddy_listas, antigo->buddy_listas, sizeof(fs.buddy_listas));
+    memcpy(fs.mapa_caudas, antigo->mapa_caudas, sizeof(fs.mapa_caudas));
+    fs.diretorio_atual = antigo->diretorio_atual;
+    fs.sistema_montado = antigo->sistema_montado;
+    memcpy(fs.caminho_atual, antigo->caminho_atual, sizeof(fs.caminho_atual));
+    
+    free(antigo);
+    return 0;
+}
+
+// Lê uma imagem da versão 8 (posicionada no início) para fs. Só o superbloco
+// muda; o resto é copiado.
+int converter_sistema_v8(FILE *arquivo) {
+    SistemaArquivosV8 *antigo = malloc(sizeof(SistemaArquivosV8));
+    if (!antigo) {
+        printf("Erro: Memória insuficiente para converter o sistema.\n");
+        return -1;
+    }
+    if (fread(antigo, sizeof(SistemaArquivosV8), 1, arquivo) != 1) {
+        free(antigo);
+        printf("Erro: Falha ao ler dados do disco.\n");
+        return -1;
+    }
+    
+    converter_superbloco_v8(&antigo->superbloco);
+    memcpy(fs.bitmap_inodes, antigo->bitmap_inodes, sizeof(fs.bitmap_inodes));
+    memcpy(fs.bitmap_blocos, antigo->bitmap_blocos, sizeof(fs.bitmap_blocos));
+    memcpy(fs.tabela_inodes, antigo->tabela_inodes, sizeof(fs.tabela_inodes));
+    memcpy(fs.blocos, antigo->blocos, sizeof(fs.blocos));
+    memcpy(fs.bytes_validos, antigo->bytes_validos, sizeof(fs.bytes_validos));
+    memcpy(fs.buddy_ordem, antigo->buddy_ordem, sizeof(fs.buddy_ordem));
+    memcpy(fs.buddy_proximo, antigo->buddy_proximo, sizeof(fs.buddy_proximo));
+    memcpy(fs.buddy_anterior, antigo->buddy_anterior, sizeof(fs.buddy_anterior));
+    memcpy(fs.buddy_listas, antigo->buddy_listas, sizeof(fs.buddy_listas));
+    memcpy(fs.mapa_caudas, antigo->mapa_caudas, sizeof(fs.mapa_caudas));
+    fs.diretorio_atual = antigo->diretorio_atual;
+    fs.sistema_montado = antigo->sistema_montado;
+    memcpy(fs.caminho_atual, antigo->caminho_atual, sizeof(fs.caminho_atual));
+    
+    free(antigo);
+    return 0;
+}
+
 // Carrega o sistema do arquivo binário
 int carregar_sistema_disco() {
     FILE *arquivo = fopen(ARQUIVO_SISTEMA, "rb");
@@ -785,21 +4775,50 @@ int carregar_sistema_disco() {
         return -1;
     }
     
-    // Carrega toda a estrutura do sistema de arquivos
-    size_t bytes_lidos = fread(&fs, sizeof(SistemaArquivos), 1, arquivo);
-    fclose(arquivo);
-    
-    if (bytes_lidos != 1) {
-        printf("Erro: Falha ao ler dados do disco.\n");
+    // Confere o superbloco antes de carregar o resto: imagens de outra
+    // versão têm outro tamanho e não podem ser lidas de uma vez
+    Superbloco superbloco;
+    if (fread(&superbloco, sizeof(Superbloco), 1, arquivo) != 1 ||
+        superbloco.magic != MAGIC_NUMBER) {
+        fclose(arquivo);
+        printf("Erro: Arquivo de sistema inválido.\n");
         return -1;
     }
     
-    // Verifica se o arquivo é válido
-    if (fs.superbloco.magic != MAGIC_NUMBER) {
-        printf("Erro: Arquivo de sistema inválido.\n");
+    if (superbloco.versao != VERSAO_SFS && superbloco.versao != VERSAO_SFS_V1 &&
+        superbloco.versao != VERSAO_SFS_V7 && superbloco.versao != VERSAO_SFS_V8) {
+        fclose(arquivo);
+        printf("Erro: Versão %u do sistema de arquivos não suportada (esperada %u).\n",
+               superbloco.versao, VERSAO_SFS);
         return -1;
     }
     
+    // Carrega toda a estrutura do sistema de arquivos
+    descartar_desfragmentacao_segundo_plano();
+    fechar_arquivos_abertos();
+    limpar_cache_indireto();
+    rewind(arquivo);
+    if (superbloco.versao != VERSAO_SFS) {
+        int resultado = superbloco.versao == VERSAO_SFS_V1 ? converter_sistema_v1(arquivo)
+                        : superbloco.versao == VERSAO_SFS_V7 ? converter_sistema_v7(arquivo)
+                        : converter_sistema_v8(arquivo);
+        fclose(arquivo);
+        if (resultado < 0) return -1;
+        
+        printf("Sistema convertido da versão %u para a versão %u.\n", superbloco.versao, VERSAO_SFS);
+        salvar_sistema_disco();
+    } else {
+        size_t bytes_lidos = fread(&fs, sizeof(SistemaArquivos), 1, arquivo);
+        fclose(arquivo);
+        
+        if (bytes_lidos != 1) {
+            printf("Erro: Falha ao ler dados do disco.\n");
+            return -1;
+        }
+    }
+    
+    reconstruir_estatisticas();
+    
     printf("Sistema carregado do disco com sucesso!\n");
     printf("- Inodes usados: %u\n", fs.superbloco.total_inodes - fs.superbloco.inodes_livres);
     printf("- Blocos usados: %u\n", fs.superbloco.total_blocos - fs.superbloco.blocos_livres);
@@ -810,6 +4829,10 @@ int carregar_sistema_disco() {
 void montar_sistema() {
     printf("Montando sistema de arquivos...\n");
     
+    // Escritas dos descritores já confirmadas ao usuário (e descarregadas em
+    // fs antes do comando) iriam embora com a imagem recarregada
+    if (fs.sistema_montado && escritas_nao_salvas) salvar_sistema_disco();
+    
     if (carregar_sistema_disco() == 0) {
         printf("Sistema existente carregado do disco.\n");
         fs.sistema_montado = true;
@@ -824,14 +4847,26 @@ void montar_sistema() {
 void mostrar_ajuda() {
     printf("\nComandos do Sistema de Arquivos Simplificado:\n");
     printf("  mount         - Montar sistema existente\n");
-    printf("  format        - Formatar novo sistema\n");
-    printf("  ls            - Listar arquivos\n");
+    printf("  format [alocador=bitmap|buddy] [mapeamento=ponteiros|extents] [diretorios=hash|btree|linear] - Formatar novo sistema\n");
+    printf("  ls [quantidade] [depois_de] - Listar arquivos (ou uma página, em ordem de nome)\n");
     printf("  create <nome> - Criar arquivo\n");
     printf("  write <nome> <dados> - Escrever em arquivo\n");
-    printf("  read <nome>   - Ler arquivo\n");
+    printf("  import <nome> <arquivo_local> - Substituir o conteúdo pelo de um arquivo local\n");
+    printf("  append <nome> <dados> - Acrescentar ao fim do arquivo\n");
+    printf("  open <nome>   - Abrir arquivo para escritas com buffer (mostra o descritor)\n");
+    printf("  hwrite <descritor> <dados> - Acrescentar pelo descritor; o disco é salvo no close\n");
+    printf("  close <descritor> - Escrever o buffer, fechar e salvar\n");
+    printf("  appendv <nome> <parte> [parte ...] - Acrescentar as partes, juntas, numa só escrita\n");
+    printf("  writeat <nome> <deslocamento> <dados> - Escrever só o trecho indicado\n");
+    printf("  read <nome> [arquivo_local] - Ler arquivo (ou gravá-lo num arquivo local)\n");
+    printf("  readat <nome> <deslocamento> <bytes> - Ler um trecho do arquivo\n");
+    printf("  prealloc <nome> <bytes> - Reservar blocos sem alterar o tamanho\n");
+    printf("  truncate <nome> <tamanho> - Encolher ou estender o arquivo no lugar\n");
     printf("  delete <nome> - Excluir arquivo\n");
     printf("  info <nome>   - Informações detalhadas\n");
     printf("  stat          - Estatísticas do sistema\n");
+    printf("  defrag [nome] [taxa=<blocos/s>] - Desfragmentar arquivo(s)\n");
+    printf("  defrag bg [taxa=<blocos/s>]|off - Desfragmentação em segundo plano\n");
     printf("  save          - Salvar sistema manualmente\n");
     printf("  help          - Esta ajuda\n");
     printf("  exit          - Sair\n");
@@ -848,12 +4883,40 @@ void processar_comando(char *linha) {
     char *comando = strtok(linha, " \n");
     if (!comando) return;
     
+    // Outros comandos podem ler ou alterar os arquivos: os buffers dos
+    // descritores abertos são escritos antes
+    if (strcmp(comando, "hwrite") != 0 && strcmp(comando, "open") != 0) {
+        descarregar_arquivos_abertos();
+    }
+    
     if (strcmp(comando, "mount") == 0) {
         montar_sistema();
     } else if (strcmp(comando, "format") == 0) {
-        formatar_sistema();
+        OpcoesFormatacao opcoes = { .alocador = ALOCADOR_BITMAP, .mapeamento = MAPEAMENTO_PONTEIROS,
+                                    .diretorios = DIRETORIOS_HASH };
+        bool opcoes_validas = true;
+        char *opcao;
+        while ((opcao = strtok(NULL, " \n")) != NULL) {
+            if (!aplicar_opcao_formatacao(&opcoes, opcao)) {
+                printf("Opção de formatação desconhecida: '%s'\n", opcao);
+                printf("Uso: format [alocador=bitmap|buddy] [mapeamento=ponteiros|extents] [diretorios=hash|btree|linear]\n");
+                opcoes_validas = false;
+                break;
+            }
+        }
+        if (opcoes_validas) {
+            formatar_sistema(&opcoes);
+        }
     } else if (strcmp(comando, "ls") == 0) {
-        listar_arquivos();
+        char *quantidade_str = strtok(NULL, " \n");
+        char *depois_de = strtok(NULL, " \n");
+        char *fim = NULL;
+        unsigned long quantidade = quantidade_str ? strtoul(quantidade_str, &fim, 10) : 0;
+        if (quantidade_str && (*fim != '\0' || quantidade == 0 || quantidade > UINT32_MAX)) {
+            printf("Uso: ls [quantidade] [depois_de]\n");
+        } else {
+            listar_arquivos((uint32_t)quantidade, depois_de);
+        }
     } else if (strcmp(comando, "create") == 0) {
         char *nome = strtok(NULL, " \n");
         if (!nome) {
@@ -874,12 +4937,127 @@ void processar_comando(char *linha) {
             }
             escrever_arquivo(nome, dados);
         }
+    } else if (strcmp(comando, "import") == 0) {
+        char *nome = strtok(NULL, " \n");
+        char *origem = strtok(NULL, " \n");
+        if (!nome || !origem) {
+            printf("Uso: import <nome> <arquivo_local>\n");
+        } else {
+            importar_arquivo(nome, origem);
+        }
+    } else if (strcmp(comando, "open") == 0) {
+        char *nome = strtok(NULL, " \n");
+        if (!nome) {
+            printf("Uso: open <nome>\n");
+        } else {
+            abrir_arquivo(nome);
+        }
+    } else if (strcmp(comando, "hwrite") == 0) {
+        char *descritor_str = strtok(NULL, " ");
+        char *dados = strtok(NULL, "\n");
+        char *fim = NULL;
+        long descritor = descritor_str ? strtol(descritor_str, &fim, 10) : 0;
+        if (!descritor_str || !dados || *fim != '\0') {
+            printf("Uso: hwrite <descritor> <dados>\n");
+        } else {
+            // Remove aspas se existirem
+            if (dados[0] == '"' && dados[strlen(dados)-1] == '"') {
+                dados[strlen(dados)-1] = '\0';
+                dados++;
+            }
+            escrever_arquivo_aberto((int)descritor, dados);
+        }
+    } else if (strcmp(comando, "close") == 0) {
+        char *descritor_str = strtok(NULL, " \n");
+        char *fim = NULL;
+        long descritor = descritor_str ? strtol(descritor_str, &fim, 10) : 0;
+        if (!descritor_str || *fim != '\0') {
+            printf("Uso: close <descritor>\n");
+        } else {
+            fechar_arquivo((int)descritor);
+        }
+    } else if (strcmp(comando, "append") == 0) {
+        char *nome = strtok(NULL, " ");
+        char *dados = strtok(NULL, "\n");
+        if (!nome || !dados) {
+            printf("Uso: append <nome> <dados>\n");
+        } else {
+            // Remove aspas se existirem
+            if (dados[0] == '"' && dados[strlen(dados)-1] == '"') {
+                dados[strlen(dados)-1] = '\0';
+                dados++;
+            }
+            anexar_arquivo(nome, dados);
+        }
+    } else if (strcmp(comando, "appendv") == 0) {
+        char *nome = strtok(NULL, " \n");
+        char *partes[MAX_SEGMENTOS_ESCRITA];
+        int quantidade = 0;
+        char *parte;
+        while (quantidade <= MAX_SEGMENTOS_ESCRITA && (parte = strtok(NULL, " \n")) != NULL) {
+            if (quantidade < MAX_SEGMENTOS_ESCRITA) partes[quantidade] = parte;
+            quantidade++;
+        }
+        if (!nome || quantidade == 0 || quantidade > MAX_SEGMENTOS_ESCRITA) {
+            printf("Uso: appendv <nome> <parte> [parte ...] (até %d partes)\n", MAX_SEGMENTOS_ESCRITA);
+        } else {
+            anexar_partes_arquivo(nome, partes, quantidade);
+        }
+    } else if (strcmp(comando, "writeat") == 0) {
+        char *nome = strtok(NULL, " ");
+        char *deslocamento_str = strtok(NULL, " ");
+        char *dados = strtok(NULL, "\n");
+        char *fim = NULL;
+        unsigned long long deslocamento = deslocamento_str ? strtoull(deslocamento_str, &fim, 10) : 0;
+        if (!nome || !deslocamento_str || !dados || *fim != '\0') {
+            printf("Uso: writeat <nome> <deslocamento> <dados>\n");
+        } else {
+            // Remove aspas se existirem
+            if (dados[0] == '"' && dados[strlen(dados)-1] == '"') {
+                dados[strlen(dados)-1] = '\0';
+                dados++;
+            }
+            escrever_arquivo_em(nome, deslocamento, dados);
+        }
     } else if (strcmp(comando, "read") == 0) {
         char *nome = strtok(NULL, " \n");
+        char *destino = strtok(NULL, " \n");
         if (!nome) {
-            printf("Uso: read <nome>\n");
+            printf("Uso: read <nome> [arquivo_local]\n");
+        } else {
+            ler_arquivo(nome, destino);
+        }
+    } else if (strcmp(comando, "readat") == 0) {
+        char *nome = strtok(NULL, " \n");
+        char *deslocamento_str = strtok(NULL, " \n");
+        char *bytes_str = strtok(NULL, " \n");
+        char *fim_deslocamento = NULL, *fim_bytes = NULL;
+        unsigned long long deslocamento = deslocamento_str ? strtoull(deslocamento_str, &fim_deslocamento, 10) : 0;
+        unsigned long long bytes = bytes_str ? strtoull(bytes_str, &fim_bytes, 10) : 0;
+        if (!nome || !deslocamento_str || !bytes_str || *fim_deslocamento != '\0' || *fim_bytes != '\0') {
+            printf("Uso: readat <nome> <deslocamento> <bytes>\n");
+        } else {
+            ler_arquivo_em(nome, deslocamento, bytes);
+        }
+    } else if (strcmp(comando, "prealloc") == 0) {
+        char *nome = strtok(NULL, " \n");
+        char *bytes_str = strtok(NULL, " \n");
+        char *fim = NULL;
+        unsigned long long bytes = bytes_str ? strtoull(bytes_str, &fim, 10) : 0;
+        if (!nome || !bytes_str || *fim != '\0') {
+            printf("Uso: prealloc <nome> <bytes>\n");
+        } else {
+            prealocar_arquivo(nome, bytes);
+        }
+    } else if (strcmp(comando, "truncate") == 0) {
+        char *nome = strtok(NULL, " \n");
+        char *tamanho_str = strtok(NULL, " \n");
+        char *fim = NULL;
+        unsigned long long tamanho = tamanho_str ? strtoull(tamanho_str, &fim, 10) : 0;
+        if (!nome || !tamanho_str || *fim != '\0') {
+            printf("Uso: truncate <nome> <tamanho>\n");
         } else {
-            ler_arquivo(nome);
+            truncar_arquivo(nome, tamanho);
         }
     } else if (strcmp(comando, "delete") == 0) {
         char *nome = strtok(NULL, " \n");
@@ -897,6 +5075,34 @@ void processar_comando(char *linha) {
         }
     } else if (strcmp(comando, "stat") == 0) {
         estatisticas_sistema();
+    } else if (strcmp(comando, "defrag") == 0) {
+        char *nome = NULL;
+        bool segundo_plano = false, desligar = false, argumentos_validos = true;
+        uint32_t taxa = 0;
+        char *arg;
+        while ((arg = strtok(NULL, " \n")) != NULL) {
+            if (strncmp(arg, "taxa=", 5) == 0) {
+                char *fim;
+                unsigned long valor = strtoul(arg + 5, &fim, 10);
+                if (*fim != '\0' || valor == 0 || valor > UINT32_MAX) argumentos_validos = false;
+                taxa = (uint32_t)valor;
+            } else if (strcmp(arg, "bg") == 0 && !nome) {
+                segundo_plano = true;
+            } else if (strcmp(arg, "off") == 0 && segundo_plano) {
+                desligar = true;
+            } else if (!nome && !segundo_plano) {
+                nome = arg;
+            } else {
+                argumentos_validos = false;
+            }
+        }
+        if (!argumentos_validos) {
+            printf("Uso: defrag [nome] [taxa=<blocos/s>] | defrag bg [taxa=<blocos/s>] | defrag bg off\n");
+        } else if (segundo_plano) {
+            configurar_desfragmentacao_segundo_plano(!desligar, taxa > 0 ? taxa : TAXA_DESFRAG_PADRAO);
+        } else {
+            desfragmentar(nome, taxa);
+        }
     } else if (strcmp(comando, "save") == 0) {
         if (fs.sistema_montado) {
             salvar_sistema_disco();
@@ -906,6 +5112,7 @@ void processar_comando(char *linha) {
     } else if (strcmp(comando, "help") == 0) {
         mostrar_ajuda();
     } else if (strcmp(comando, "exit") == 0) {
+        if (escritas_nao_salvas) salvar_sistema_disco();
         printf("Saindo...\n");
         exit(0);
     } else {
@@ -941,10 +5148,17 @@ int main() {
         fflush(stdout);
         
         if (!fgets(linha, sizeof(linha), stdin)) {
+            // Fim da entrada: o que os descritores abertos escreveram vai para o disco
+            pthread_mutex_lock(&trava_fs);
+            descarregar_arquivos_abertos();
+            if (escritas_nao_salvas) salvar_sistema_disco();
+            pthread_mutex_unlock(&trava_fs);
             break;
         }
         
+        pthread_mutex_lock(&trava_fs);
         processar_comando(linha);
+        pthread_mutex_unlock(&trava_fs);
     }
     
     return 0;